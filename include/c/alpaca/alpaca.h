@@ -5,11 +5,21 @@
 #ifndef __ALPACA_C_ALPACA_H
 #define __ALPACA_C_ALPACA_H
 
+#include "arena.h"
+#include "buffer.h"
 #include "connections.h"
+#include "header.h"
 #include "http.h"
 #include "modules.h"
+#include "poll.h"
+#include "pool.h"
+#include "reactor.h"
 #include "read.h"
+#include "resolve.h"
+#include "route.h"
 #include "server.h"
+#include "timers.h"
 #include "uri.h"
+#include "workers.h"
 
 #endif
@@ -0,0 +1,40 @@
+/* arena.h
+ * -------
+ * bump-pointer allocation for data that's all released at once. */
+
+#ifndef __ALPACA_C_ARENA_H
+#define __ALPACA_C_ARENA_H
+
+#include <sys/types.h>
+
+#include "defs.h"
+
+/* size of the blocks we allocate from and the alignment of everything we
+ * hand out.  anything too large for a block gets its own. */
+#define AL_ARENA_BLOCK_SIZE  4096
+#define AL_ARENA_ALIGN       (sizeof (void *) * 2)
+
+/* a block of memory, used from front to back. */
+struct _al_arena_block_t {
+   size_t size, used;
+   al_arena_block_t *next;
+   unsigned char *data;
+};
+
+/* an arena.  blocks are kept when the arena is reset so they can be used
+ * again; only large blocks are freed. */
+struct _al_arena_t {
+   al_arena_block_t *first, *current, *large;
+   size_t block_size;
+};
+
+/* arena management. */
+int al_arena_init (al_arena_t *a, size_t block_size);
+void *al_arena_alloc (al_arena_t *a, size_t size);
+void *al_arena_calloc (al_arena_t *a, size_t size);
+char *al_arena_strdup (al_arena_t *a, const char *string);
+char *al_arena_strndup (al_arena_t *a, const char *string, size_t len);
+int al_arena_reset (al_arena_t *a);
+int al_arena_clear (al_arena_t *a);
+
+#endif
@@ -0,0 +1,71 @@
+/* buffer.h
+ * --------
+ * refcounted buffers and queues of buffer segments for scatter/gather
+ * output. */
+
+#ifndef __ALPACA_C_BUFFER_H
+#define __ALPACA_C_BUFFER_H
+
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#include "defs.h"
+
+/* smallest buffer allocated for copied data.  small writes are packed
+ * together into buffers of at least this size. */
+#define AL_BUFFER_MIN_SIZE  1024
+
+/* a block of memory shared by any number of segments.  data is released
+ * once the last reference is dropped.  buffers with AL_BUFFER_FILE have no
+ * data; their bytes are read from 'fd' starting at 'offset'. */
+struct _al_buffer_t {
+   al_flags_t flags;
+   unsigned char *data;
+   size_t len, size;
+   int refs;
+
+   /* file contents, sent with sendfile(). */
+   int fd;
+   off_t offset;
+
+   /* called when the last reference is dropped, before data is freed. */
+   al_buffer_func *free_func;
+   void *arg;
+};
+
+/* a range of bytes in a buffer, waiting in a queue. */
+struct _al_buffer_seg_t {
+   al_buffer_t *buffer;
+   size_t pos, len;
+   al_buffer_seg_t *next;
+};
+
+/* segments in the order they should be written. */
+struct _al_buffer_queue_t {
+   al_buffer_seg_t *first, *last;
+   size_t len;
+   int count;
+};
+
+/* buffer management. */
+al_buffer_t *al_buffer_new (size_t size);
+al_buffer_t *al_buffer_take (unsigned char *data, size_t len, size_t size);
+al_buffer_t *al_buffer_wrap (const unsigned char *data, size_t len,
+   al_buffer_func *free_func, void *arg);
+al_buffer_t *al_buffer_file (int fd, off_t offset, size_t len,
+   al_flags_t flags);
+al_buffer_t *al_buffer_ref (al_buffer_t *b);
+int al_buffer_unref (al_buffer_t *b);
+
+/* queue management. */
+int al_buffer_queue_append (al_buffer_queue_t *q, al_buffer_t *b, size_t pos,
+   size_t len);
+int al_buffer_queue_copy (al_buffer_queue_t *q, const unsigned char *data,
+   size_t len);
+int al_buffer_queue_splice (al_buffer_queue_t *dst, al_buffer_queue_t *src);
+int al_buffer_queue_iov (const al_buffer_queue_t *q, struct iovec *iov,
+   int iov_max, size_t max);
+size_t al_buffer_queue_consume (al_buffer_queue_t *q, size_t bytes);
+int al_buffer_queue_clear (al_buffer_queue_t *q);
+
+#endif
@@ -10,38 +10,53 @@
 #include <sys/types.h>
 #include <sys/socket.h>
 
+#include "buffer.h"
 #include "defs.h"
+#include "timers.h"
 
 /* our connections. */
 struct _al_connection_t {
    /* flags! */
    al_flags_t flags;
-   struct timeval timeout;
+   al_timer_t timeout;
 
-   /* socket stuff. */
+   /* socket stuff.  'addr' points to 'addr_data' when we have one. */
    int fd_in, fd_out;
-   struct sockaddr_in *addr;
+   al_flags_t poll_events;
+   struct sockaddr_in *addr, addr_data;
    socklen_t addr_size;
 
-   /* input/output buffers. */
-   unsigned char *input, *output;
-   size_t input_size,  input_len,  input_pos;
-   size_t output_size, output_len, output_pos, output_max;
+   /* input buffer and queued output.  'input_hint' is how much we expect
+    * our next read to bring in, and 'input_max' is the most unused input we
+    * hold on to.  'output_max' is the number of bytes staged for writing,
+    * and 'output_high' and 'output_low' are our output watermarks. */
+   unsigned char *input;
+   size_t input_size, input_len, input_pos, input_hint, input_max;
+   al_buffer_queue_t output;
+   size_t output_max, output_high, output_low;
 
-   /* custom data assigned to each connection. */
-   al_module_t *module_list;
+   /* custom data assigned to each connection, and the modules with a slot
+    * of their own (see al_module_register()). */
+   al_module_t *module_list, *module_slots[AL_MODULE_SLOTS];
 
-   /* link to server. */
+   /* our id, for reaching us from other threads with al_server_submit(). */
+   al_connection_id_t id;
+
+   /* link to server and the reactor that owns us. */
    al_server_t *server;
+   al_reactor_t *reactor;
    al_connection_t *prev, *next;
+   al_connection_t *pending_prev, *pending_next;
 
-   /* identifying data. */
+   /* identifying data.  'ip_address' points to 'ip_data'. */
    char *ip_address, *hostname;
+   char ip_data[INET_ADDRSTRLEN];
 };
 
-/* data sent via AL_SERVER_PRE_WRITE_FUNC. */
+/* data sent via AL_SERVER_PRE_WRITE_FUNC.  'data' is the first segment
+ * queued for output. */
 struct _al_func_pre_write_t {
-   unsigned char *data;
+   al_buffer_seg_t *data;
    size_t data_len;
 };
 
@@ -49,6 +64,8 @@ struct _al_func_pre_write_t {
 al_connection_t *al_connection_new (al_server_t *server, int fd_in, int fd_out,
    const struct sockaddr_in *addr, socklen_t addr_size, al_flags_t flags);
 int al_connection_free (al_connection_t *c);
+int al_connection_lock (al_connection_t *c);
+int al_connection_unlock (al_connection_t *c);
 int al_connection_close (al_connection_t *c);
 int al_connection_append_buffer (al_connection_t *c, unsigned char **buf,
    size_t *size, size_t *len, size_t *pos, const unsigned char *input,
@@ -58,16 +75,30 @@ int al_connection_fetch_buffer (al_connection_t *c, const unsigned char **buf,
    size_t osize);
 int al_connection_read (al_connection_t *c, unsigned char *buf, size_t size);
 int al_connection_fd_read (al_connection_t *c);
+int al_connection_input_trim (al_connection_t *c);
+int al_connection_feed (al_connection_t *c, size_t new_len);
+int al_connection_set_input_max (al_connection_t *c, size_t max);
 int al_connection_fd_write (al_connection_t *c);
 int al_connection_write (al_connection_t *c, const unsigned char *buf,
    size_t size);
 int al_connection_write_string (al_connection_t *c, const char *string);
+int al_connection_write_buffer (al_connection_t *c, al_buffer_t *b);
+int al_connection_write_queue (al_connection_t *c, al_buffer_queue_t *q);
+int al_connection_set_output_watermarks (al_connection_t *c, size_t high,
+   size_t low);
 int al_connection_wrote (al_connection_t *c);
 int al_connection_stage_output (al_connection_t *c);
+int al_connection_pending (al_connection_t *c);
+int al_connection_notify_writable (al_connection_t *c);
+int al_connection_update_poll (al_connection_t *c);
 al_module_t *al_connection_module_new (al_connection_t *connection,
    const char *name, void *data, size_t data_size, al_module_func *free_func);
 al_module_t *al_connection_module_get (const al_connection_t *connection,
    const char *name);
+al_module_t *al_connection_module_slot (const al_connection_t *connection,
+   int id);
 int al_connection_set_timeout (al_connection_t *connection, float timeout);
+int al_connection_timer_set (al_connection_t *connection, al_timer_t *timer,
+   unsigned long ms);
 
 #endif
@@ -5,6 +5,7 @@
 #ifndef __ALPACA_C_DEFS_H
 #define __ALPACA_C_DEFS_H
 
+#include <stdint.h>
 #include <stdio.h>
 
 #include "llist.h"
@@ -13,6 +14,28 @@
 /* default options for HTTP modules. */
 #define AL_HTTP_TIMEOUT       5.00f
 
+/* largest request line and header we'll wait for, and the number of request
+ * header fields parsed without allocating. */
+#define AL_HTTP_HEAD_MAX      65536
+#define AL_HTTP_HEADERS_MAX   32
+
+/* most requests queued on a connection before we stop parsing more, and
+ * the largest response body copied in with its head rather than written
+ * separately. */
+#define AL_HTTP_PIPELINE_MAX  16
+#define AL_HTTP_PACK_MAX      2048
+
+/* largest request body we'll accept, and the longest chunk size or trailer
+ * line we'll wait for in chunked bodies. */
+#define AL_HTTP_BODY_MAX      (16 * 1024 * 1024)
+#define AL_HTTP_CHUNK_LINE_MAX 1024
+
+/* most parameters captured by a single route. */
+#define AL_HTTP_PARAMS_MAX    8
+
+/* most module names that can be registered for a slot of their own. */
+#define AL_MODULE_SLOTS       8
+
 /* URI flags. */
 #define AL_URI_RELATIVE       0x01
 
@@ -24,21 +47,90 @@
 
 /* HTTP state flags. */
 #define AL_STATE_PERSIST      0x01
+#define AL_STATE_DONE         0x02
+#define AL_STATE_STREAM       0x04
+#define AL_STATE_CHUNKED      0x08
+#define AL_STATE_DEFERRED     0x10
+
+/* HTTP function flags. */
+#define AL_HTTP_FUNC_WORKER   0x01
+
+/* HTTP session flags. */
+#define AL_SESSION_CLOSE      0x01
+#define AL_SESSION_READING    0x02
+#define AL_SESSION_HELD       0x04
 
 /* HTTP states. */
 #define AL_STATE_METHOD       0
 #define AL_STATE_HEADER       1
+#define AL_STATE_BODY         2
+#define AL_STATE_CHUNK_SIZE   3
+#define AL_STATE_CHUNK_DATA   4
+#define AL_STATE_CHUNK_END    5
+#define AL_STATE_TRAILER      6
 
 /* types of headers. */
 #define AL_HEADER_REQUEST     0
 #define AL_HEADER_RESPONSE    1
 
+/* header names interned to slots of their own.  other names are found
+ * through a hash table with room for AL_HTTP_HEADER_TABLE_SIZE entries. */
+#define AL_HEADER_ID_NONE                0
+#define AL_HEADER_ID_HOST                1
+#define AL_HEADER_ID_CONNECTION          2
+#define AL_HEADER_ID_CONTENT_LENGTH      3
+#define AL_HEADER_ID_CONTENT_TYPE        4
+#define AL_HEADER_ID_TRANSFER_ENCODING   5
+#define AL_HEADER_ID_ACCEPT              6
+#define AL_HEADER_ID_ACCEPT_ENCODING     7
+#define AL_HEADER_ID_USER_AGENT          8
+#define AL_HEADER_ID_COOKIE              9
+#define AL_HEADER_ID_EXPECT             10
+#define AL_HEADER_ID_KEEP_ALIVE         11
+#define AL_HEADER_ID_CACHE_CONTROL      12
+#define AL_HEADER_ID_DATE               13
+#define AL_HEADER_ID_SERVER             14
+#define AL_HEADER_ID_LOCATION           15
+#define AL_HEADER_ID_SET_COOKIE         16
+#define AL_HEADER_ID_COUNT              17
+#define AL_HTTP_HEADER_TABLE_SIZE       64
+
+/* types of route nodes. */
+#define AL_ROUTE_ROOT         0
+#define AL_ROUTE_STATIC       1
+#define AL_ROUTE_PARAM        2
+#define AL_ROUTE_WILDCARD     3
+
 /* connection flags. */
 #define AL_CONNECTION_WRITING    0x01
 #define AL_CONNECTION_WROTE      0x02
 #define AL_CONNECTION_CLOSING    0x04
 #define AL_CONNECTION_KEEP_OPEN  0x08
 #define AL_CONNECTION_TIMED_OUT  0x10
+#define AL_CONNECTION_PENDING    0x20
+#define AL_CONNECTION_NOT_SOCKET 0x40
+#define AL_CONNECTION_NOTIFY_WRITABLE 0x80
+#define AL_CONNECTION_READ_FILLED 0x100
+#define AL_CONNECTION_READ_PAUSED 0x200
+
+/* connections read straight into their input buffer, asking for between
+ * AL_CONNECTION_READ_MIN and AL_CONNECTION_READ_MAX bytes at a time.
+ * input buffers larger than AL_CONNECTION_INPUT_KEEP are freed once
+ * everything in them has been used. */
+#define AL_CONNECTION_READ_MIN   4096
+#define AL_CONNECTION_READ_MAX   (256 * 1024)
+#define AL_CONNECTION_INPUT_KEEP (16 * 1024)
+
+/* default limit on input a connection holds on to before it's used. */
+#define AL_CONNECTION_INPUT_MAX  (1024 * 1024)
+
+/* default output watermarks.  writes are refused with
+ * AL_CONNECTION_WOULD_BLOCK once AL_CONNECTION_OUTPUT_HIGH bytes are queued
+ * (never, by default), and AL_SERVER_FUNC_WRITABLE runs once we're down to
+ * AL_CONNECTION_OUTPUT_LOW. */
+#define AL_CONNECTION_OUTPUT_HIGH 0
+#define AL_CONNECTION_OUTPUT_LOW  0
+#define AL_CONNECTION_WOULD_BLOCK (-1)
 
 /* server functions. */
 #define AL_SERVER_FUNC_JOIN      0
@@ -48,23 +140,79 @@
 #define AL_SERVER_FUNC_STOPPED   4
 #define AL_SERVER_FUNC_CLOSED    5
 #define AL_SERVER_FUNC_TIMEOUT   6
-#define AL_SERVER_FUNC_MAX       8
+#define AL_SERVER_FUNC_HOSTNAME  7
+#define AL_SERVER_FUNC_WRITABLE  8
+#define AL_SERVER_FUNC_INPUT_FULL 9
+#define AL_SERVER_FUNC_MAX       10
 
 /* server state flags.  unless you're working on server code,
  * these are read-only. */
 #define AL_SERVER_STATE_OPEN    0x01
 #define AL_SERVER_STATE_QUIT    0x02
 #define AL_SERVER_STATE_RUNNING 0x04
-#define AL_SERVER_STATE_PIPE    0x08
-#define AL_SERVER_STATE_IN_LOOP 0x10
+
+/* reactor state flags. */
+#define AL_REACTOR_STATE_OPEN    0x01
+#define AL_REACTOR_STATE_WAKE    0x02
+#define AL_REACTOR_STATE_IN_LOOP 0x04
+#define AL_REACTOR_STATE_SOCKET  0x08
+#define AL_REACTOR_STATE_MUTEX   0x10
+#define AL_REACTOR_STATE_THREAD  0x20
+#define AL_REACTOR_STATE_EVENTFD 0x40
+
+/* data posted to reactors. */
+#define AL_REACTOR_POST_WRITE     0
+#define AL_REACTOR_POST_HOSTNAME  1
+#define AL_REACTOR_POST_FUNC      2
+#define AL_REACTOR_POST_CANCELLED 3
+#define AL_REACTOR_POST_SUBMIT    4
+#define AL_REACTOR_POST_SPLICE    5
+
+/* connection ids pack the generation of their reactor's slot (high 32 bits),
+ * the reactor's index (8 bits), and the slot (24 bits).  zero is never an
+ * id. */
+#define AL_CONNECTION_ID_NONE     0
+#define AL_CONNECTION_ID_SLOTS    (1 << 24)
+#define AL_SERVER_REACTORS_MAX    256
+
+/* default accept() settings. */
+#define AL_SERVER_BACKLOG        511
+#define AL_SERVER_ACCEPT_BUDGET  64
 
 /* server flags. */
-/* TODO: 0x01 */
+#define AL_SERVER_RESOLVE_HOSTNAMES 0x01
 #define AL_SERVER_CLOSE_AFTER_STOP  0x02
+#define AL_SERVER_USE_SELECT        0x04
+
+/* buffer flags. */
+#define AL_BUFFER_OWNED          0x01
+#define AL_BUFFER_FILE           0x02
+#define AL_BUFFER_CLOSE          0x04
+#define AL_BUFFER_POOLED         0x08
+
+/* resolver state flags. */
+#define AL_RESOLVER_STATE_QUIT   0x01
+
+/* worker pool state flags. */
+#define AL_WORKERS_STATE_QUIT    0x01
+
+/* default depth of the worker queue. */
+#define AL_WORKERS_QUEUE_MAX     1024
+
+/* poller types. */
+#define AL_POLL_SELECT  0
+#define AL_POLL_EPOLL   1
+
+/* poller events. */
+#define AL_POLL_IN      0x01
+#define AL_POLL_OUT     0x02
+#define AL_POLL_ERROR   0x04
 
 /* type definitions. */
 typedef unsigned long int al_flags_t;
+typedef uint64_t al_connection_id_t;
 typedef struct _al_server_t         al_server_t;
+typedef struct _al_server_stats_t   al_server_stats_t;
 typedef struct _al_connection_t     al_connection_t;
 typedef struct _al_mutex_t          al_mutex_t;
 typedef struct _al_func_read_t      al_func_read_t;
@@ -73,10 +221,32 @@ typedef struct _al_module_t         al_module_t;
 typedef struct _al_http_func_def_t  al_http_func_def_t;
 typedef struct _al_http_t           al_http_t;
 typedef struct _al_http_state_t     al_http_state_t;
+typedef struct _al_http_session_t   al_http_session_t;
 typedef struct _al_http_header_t    al_http_header_t;
+typedef struct _al_http_headers_t   al_http_headers_t;
+typedef struct _al_http_route_t     al_http_route_t;
+typedef struct _al_http_param_t     al_http_param_t;
 typedef struct _al_uri_t            al_uri_t;
 typedef struct _al_uri_path_t       al_uri_path_t;
 typedef struct _al_uri_parameter_t  al_uri_parameter_t;
+typedef struct _al_poll_t           al_poll_t;
+typedef struct _al_poll_event_t     al_poll_event_t;
+typedef struct _al_reactor_t        al_reactor_t;
+typedef struct _al_reactor_post_t   al_reactor_post_t;
+typedef struct _al_reactor_slot_t   al_reactor_slot_t;
+typedef struct _al_timer_t          al_timer_t;
+typedef struct _al_timer_wheel_t    al_timer_wheel_t;
+typedef struct _al_resolver_t       al_resolver_t;
+typedef struct _al_resolve_entry_t  al_resolve_entry_t;
+typedef struct _al_resolve_request_t al_resolve_request_t;
+typedef struct _al_workers_t        al_workers_t;
+typedef struct _al_worker_job_t     al_worker_job_t;
+typedef struct _al_buffer_t         al_buffer_t;
+typedef struct _al_buffer_seg_t     al_buffer_seg_t;
+typedef struct _al_buffer_queue_t   al_buffer_queue_t;
+typedef struct _al_arena_t          al_arena_t;
+typedef struct _al_arena_block_t    al_arena_block_t;
+typedef struct _al_pool_cache_t     al_pool_cache_t;
 
 /* function macros and typedefs. */
 #define AL_SERVER_FUNC(x) \
@@ -93,4 +263,33 @@ typedef AL_MODULE_FUNC(al_module_func);
       const char *data, al_uri_path_t *path)
 typedef AL_HTTP_FUNC(al_http_func);
 
+/* HTTP functions return this to finish their response later with
+ * al_http_complete(). */
+#define AL_HTTP_PENDING 1
+
+#define AL_HTTP_BODY_FUNC(x) \
+   int x (al_http_state_t *request, const unsigned char *data, size_t size, \
+      void *arg)
+typedef AL_HTTP_BODY_FUNC(al_http_body_func);
+
+#define AL_HTTP_STREAM_FUNC(x) \
+   int x (al_http_state_t *request, void *arg)
+typedef AL_HTTP_STREAM_FUNC(al_http_stream_func);
+
+#define AL_REACTOR_FUNC(x) \
+   int x (al_reactor_t *reactor, al_connection_t *connection, void *arg)
+typedef AL_REACTOR_FUNC(al_reactor_func);
+
+#define AL_WORKER_FUNC(x) \
+   int x (al_workers_t *workers, void *arg)
+typedef AL_WORKER_FUNC(al_worker_func);
+
+#define AL_TIMER_FUNC(x) \
+   int x (al_timer_t *timer, void *arg)
+typedef AL_TIMER_FUNC(al_timer_func);
+
+#define AL_BUFFER_FUNC(x) \
+   int x (al_buffer_t *buffer, void *arg)
+typedef AL_BUFFER_FUNC(al_buffer_func);
+
 #endif
@@ -0,0 +1,53 @@
+/* header.h
+ * --------
+ * indexed storage for HTTP header fields. */
+
+#ifndef __ALPACA_C_HEADER_H
+#define __ALPACA_C_HEADER_H
+
+#include <stddef.h>
+
+#include "defs.h"
+
+/* header information.  headers are allocated from their state's arena, and
+ * parsed request headers borrow their strings from the input buffer.  'id'
+ * is the interned name (or AL_HEADER_ID_NONE) and 'hash' is the hash of the
+ * name in lowercase. */
+struct _al_http_header_t {
+   int type, id;
+   unsigned int hash;
+   char *name, *value;
+   size_t name_len, value_len;
+   al_http_state_t *state;
+   al_http_header_t *prev, *next;
+};
+
+/* a set of headers, kept in the order they were added.  names are matched
+ * without regard to case.  interned names have a slot of their own, others
+ * are indexed with linear probing.  headers that couldn't be indexed
+ * (repeated names, or a full table) are only found by walking the list. */
+struct _al_http_headers_t {
+   int type, count;
+   al_http_header_t *first, *last;
+   al_http_header_t *known[AL_HEADER_ID_COUNT];
+   al_http_header_t *table[AL_HTTP_HEADER_TABLE_SIZE];
+   int table_count, unindexed;
+};
+
+/* header names. */
+int al_http_header_intern (const char *name, size_t len, unsigned int *hash);
+const char *al_http_header_id_name (int id);
+
+/* header sets. */
+int al_http_headers_init (al_http_headers_t *hs, int type);
+al_http_header_t *al_http_headers_find (const al_http_headers_t *hs,
+   const char *name);
+al_http_header_t *al_http_headers_find_id (const al_http_headers_t *hs,
+   int id);
+int al_http_headers_link (al_http_headers_t *hs, al_http_header_t *h);
+int al_http_headers_unlink (al_http_headers_t *hs, al_http_header_t *h);
+size_t al_http_headers_size (const al_http_headers_t *hs);
+unsigned char *al_http_headers_serialize (const al_http_headers_t *hs,
+   unsigned char *out);
+
+#endif
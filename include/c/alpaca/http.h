@@ -5,11 +5,19 @@
 #ifndef __ALPACA_C_HTTP_H
 #define __ALPACA_C_HTTP_H
 
+#include <pthread.h>
+#include <sys/types.h>
+
+#include "arena.h"
+#include "buffer.h"
 #include "defs.h"
+#include "header.h"
+#include "route.h"
 
 /* definitions for http functions. */
 struct _al_http_func_def_t {
    char *verb;
+   al_flags_t flags;
    al_http_t *http;
    al_http_func *func;
    al_http_func_def_t *prev, *next;
@@ -20,81 +28,169 @@ struct _al_http_t {
    al_server_t *server;
    al_module_t *module;
    al_http_func_def_t *func_list;
+   al_http_route_t *route_list;
 
    /* default options. */
    float timeout;
+   int pipeline_max;
+   size_t body_max;
+
+   /* guards deferred requests against their connection going away while
+    * they're being completed. */
+   pthread_mutex_t mutex;
 };
 
-/* state information for each connection. */
+/* state information for each request.  'verb', 'uri_str', 'version_str' and
+ * request headers point into the connection's input buffer until the
+ * request is finished or detached with al_http_state_detach(). */
 struct _al_http_state_t {
    int state, version, status_code;
    al_flags_t flags;
    char *verb, *uri_str, *version_str;
    al_connection_t *connection;
    al_http_t *http;
-   al_http_header_t *header_request, *header_response;
+   al_http_session_t *session;
+   al_http_headers_t header_request, header_response;
    al_uri_t *uri;
 
-   /* output buffer. */
+   /* output buffer, followed by a file sent with sendfile(). */
    unsigned char *output;
    size_t output_size, output_len, output_pos;
+   al_buffer_t *file;
+
+   /* request body, passed to 'body_func' as it arrives.  'body_left' is
+    * what's left of the body or the current chunk. */
+   size_t body_len, body_left;
+   al_http_body_func *body_func;
+   void *body_arg;
+
+   /* streaming responses ask 'stream_func' for more once everything so far
+    * has been sent. */
+   al_http_stream_func *stream_func;
+   void *stream_arg;
+
+   /* set by al_http_complete() under the module's mutex, from whichever
+    * thread finishes a deferred request. */
+   int completed;
+
+   /* function run for us by a worker thread. */
+   al_http_func_def_t *worker_func;
+
+   /* the finished response, waiting for the responses before it. */
+   al_buffer_queue_t response;
+   al_http_state_t *next;
+
+   /* request parsing.  requests stay in the input buffer until they're
+    * finished, but the buffer may move while we wait for the rest, so
+    * strings are recorded as offsets from 'head' until then. */
+   char *head;
+   size_t parse_pos, line_pos, verb_pos, uri_pos, version_pos;
+   size_t field_name[AL_HTTP_HEADERS_MAX], field_value[AL_HTTP_HEADERS_MAX];
+   int field_count;
+
+   /* memory for the current request, released once it's finished. */
+   al_arena_t arena;
+
+   /* parameters captured by our route. */
+   al_http_param_t params[AL_HTTP_PARAMS_MAX];
+   int param_count;
 };
 
-/* header information. */
-struct _al_http_header_t {
-   int type;
-   char *name, *value;
-   al_http_state_t *state;
-   al_http_header_t *prev, *next;
+/* HTTP data for each connection.  requests are parsed into 'current' and
+ * queued once their head is complete, so pipelined requests are dispatched
+ * without waiting for the responses before them.  'body' is the queued
+ * request whose body we're reading, which comes before anything else.
+ * responses are written in the order their requests arrived.  connections
+ * don't time out while 'deferred' requests are waiting to be completed. */
+struct _al_http_session_t {
+   al_flags_t flags;
+   al_connection_t *connection;
+   al_http_t *http;
+   al_http_state_t *current, *body;
+   al_http_state_t *queue_first, *queue_last;
+   int queue_count, deferred;
+
+   /* finished states, kept along with their arenas for the next request. */
+   al_http_state_t *free_list;
 };
 
 /* top-level http mangement functions. */
 al_http_t *al_http_init (al_server_t *server);
 al_http_t *al_http_get (const al_server_t *server);
 al_http_state_t *al_http_get_state (const al_connection_t *connection);
+al_http_session_t *al_http_get_session (const al_connection_t *connection);
 al_http_func_def_t *al_http_set_func (al_http_t *http, const char *verb,
    al_http_func *func);
 al_http_func_def_t *al_http_get_func (const al_http_t *http, const char *verb);
 int al_http_free_func (al_http_func_def_t *rf);
+int al_http_func_set_worker (al_http_func_def_t *fd, int worker);
 
 /* state management. */
-int al_http_state_method  (al_http_state_t *state, const char *line);
-int al_http_state_header  (al_http_state_t *state, const char *line);
+int al_http_state_method  (al_http_state_t *state, char *line);
+int al_http_state_header  (al_http_state_t *state, char *line);
 int al_http_state_finish  (al_http_state_t *state);
+int al_http_state_body    (al_http_state_t *state, al_func_read_t *read);
+int al_http_state_detach  (al_http_state_t *state);
 int al_http_state_reset   (al_http_state_t *state);
 int al_http_state_cleanup (al_http_state_t *state);
 int al_http_state_cleanup_output (al_http_state_t *state);
 
+/* session management. */
+al_http_state_t *al_http_session_new_state (al_http_session_t *session);
+int al_http_session_flush (al_http_session_t *session);
+
 /* state header management. */
 al_http_header_t *al_http_header_set (al_http_state_t *state,
-   al_http_header_t **headers, int type, const char *name, const char *value);
-al_http_header_t *al_http_header_get (al_http_header_t *const *headers,
+   al_http_headers_t *headers, const char *name, const char *value);
+al_http_header_t *al_http_header_get (const al_http_headers_t *headers,
    const char *name);
 al_http_header_t *al_http_header_request_set (al_http_state_t *state,
    const char *name, const char *value);
 al_http_header_t *al_http_header_request_get (const al_http_state_t *state,
    const char *name);
+al_http_header_t *al_http_header_request_get_id (const al_http_state_t *state,
+   int id);
 al_http_header_t *al_http_header_response_set (al_http_state_t *state,
    const char *name, const char *value);
 al_http_header_t *al_http_header_response_get (const al_http_state_t *state,
    const char *name);
+al_http_header_t *al_http_header_response_get_id (
+   const al_http_state_t *state, int id);
 int al_http_header_free (al_http_header_t *h);
 int al_http_header_clear (al_http_state_t *state);
 const char *al_http_status_code_string (int status_code);
 int al_http_set_status_code (al_http_state_t *state, int status_code);
 
+/* request bodies. */
+int al_http_set_body_func (al_http_state_t *state, al_http_body_func *func,
+   void *arg);
+
 /* writing to clients. */
 int al_http_write (al_http_state_t *state, const unsigned char *buf,
    size_t size);
 int al_http_write_string (al_http_state_t *state, const char *string);
 int al_http_write_stringf (al_http_state_t *state, const char *format, ...);
+int al_http_write_file (al_http_state_t *state, int fd, off_t offset,
+   off_t length);
 int al_http_write_finish (al_http_state_t *state);
 
+/* deferred responses. */
+int al_http_defer (al_http_state_t *state);
+int al_http_complete (al_http_state_t *state);
+
+/* streaming responses. */
+int al_http_stream_start (al_http_state_t *state);
+int al_http_stream_flush (al_http_state_t *state);
+int al_http_stream_end (al_http_state_t *state);
+int al_http_set_stream_func (al_http_state_t *state,
+   al_http_stream_func *func, void *arg);
+
 /* hooks and default functions. */
 AL_MODULE_FUNC (al_http_data_free);
-AL_MODULE_FUNC (al_http_state_data_free);
+AL_MODULE_FUNC (al_http_session_data_free);
 AL_SERVER_FUNC (al_http_func_read);
 AL_SERVER_FUNC (al_http_func_join);
 AL_SERVER_FUNC (al_http_func_leave);
+AL_SERVER_FUNC (al_http_func_writable);
 
 #endif
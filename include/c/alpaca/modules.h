@@ -7,23 +7,28 @@
 
 #include "defs.h"
 
-/* our generic structure, designed to work with anything. */
+/* our generic structure, designed to work with anything.  'id' is the slot
+ * registered for our name (see al_module_register()), or -1. */
 struct _al_module_t {
    /* properties. */
    char *name;
+   int id;
    void *data;
    size_t data_size;
    al_module_func *func_free;
 
-   /* generic list management. */
+   /* generic list management.  modules with an id are also found in their
+    * owner's 'slots'. */
    void *owner;
-   al_module_t **list, *prev, *next;
+   al_module_t **list, **slots, *prev, *next;
 };
 
 /* functions for module management. */
+int al_module_register (const char *name);
 al_module_t *al_module_get (al_module_t *const *list, const char *name);
-al_module_t * al_module_new (void *owner, al_module_t **list, const char *name,
-   void *data, size_t data_size, al_module_func *func_free);
+al_module_t * al_module_new (void *owner, al_module_t **list,
+   al_module_t **slots, const char *name, void *data, size_t data_size,
+   al_module_func *func_free);
 int al_module_free (al_module_t *m);
 
 #endif
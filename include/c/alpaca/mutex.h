@@ -9,10 +9,8 @@
 
 #include "defs.h"
 
-/* simple pthread mutex wrapper. */
+/* simple pthread mutex wrapper.  mutexes can be locked recursively. */
 struct _al_mutex_t {
-   int locks;
-   pthread_t p_thread;
    pthread_mutex_t p_mutex;
 };
 
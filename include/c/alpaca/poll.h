@@ -0,0 +1,49 @@
+/* poll.h
+ * ------
+ * pluggable I/O readiness notification (epoll or select) for server loops. */
+
+#ifndef __ALPACA_C_POLL_H
+#define __ALPACA_C_POLL_H
+
+#include <sys/select.h>
+#include <sys/time.h>
+
+#include "defs.h"
+
+/* a descriptor reported as ready by al_poll_wait(). */
+struct _al_poll_event_t {
+   int fd;
+   al_flags_t events;
+   void *data;
+};
+
+/* our poller.  interest is registered once and persists between calls to
+ * al_poll_wait(), regardless of the backend in use. */
+struct _al_poll_t {
+   int type, count;
+
+   /* epoll backend. */
+   int epoll_fd;
+
+   /* select() backend. */
+   fd_set fd_in, fd_out;
+   int fd_max;
+
+   /* owners of registered descriptors, indexed by descriptor. */
+   void **data;
+   int data_size;
+
+   /* events filled by al_poll_wait(). */
+   al_poll_event_t *events;
+   int events_size, events_len;
+};
+
+/* poller management. */
+al_poll_t *al_poll_new (int type);
+int al_poll_free (al_poll_t *p);
+int al_poll_add (al_poll_t *p, int fd, al_flags_t events, void *data);
+int al_poll_modify (al_poll_t *p, int fd, al_flags_t events, void *data);
+int al_poll_remove (al_poll_t *p, int fd);
+int al_poll_wait (al_poll_t *p, struct timeval *timeout);
+
+#endif
@@ -0,0 +1,37 @@
+/* pool.h
+ * ------
+ * per-thread caches of power-of-two blocks for memory that's allocated and
+ * freed all the time. */
+
+#ifndef __ALPACA_C_POOL_H
+#define __ALPACA_C_POOL_H
+
+#include <stddef.h>
+
+#include "defs.h"
+
+/* block sizes are powers of two from 2^AL_POOL_CLASS_MIN to
+ * 2^AL_POOL_CLASS_MAX bytes.  anything larger comes straight from malloc().
+ * each thread keeps up to AL_POOL_KEEP bytes of free blocks of each size. */
+#define AL_POOL_CLASS_MIN   6
+#define AL_POOL_CLASS_MAX   16
+#define AL_POOL_CLASSES     (AL_POOL_CLASS_MAX - AL_POOL_CLASS_MIN + 1)
+#define AL_POOL_KEEP        (256 * 1024)
+
+/* free blocks cached by a single thread, linked through their first
+ * bytes. */
+struct _al_pool_cache_t {
+   void *free[AL_POOL_CLASSES];
+   int count[AL_POOL_CLASSES];
+};
+
+/* pool allocation.  blocks must be freed with the size they were allocated
+ * with (or anything up to al_pool_size() of it), from any thread. */
+size_t al_pool_size (size_t size);
+void *al_pool_alloc (size_t size);
+void *al_pool_calloc (size_t size);
+void *al_pool_realloc (void *p, size_t old_size, size_t new_size,
+   size_t keep);
+int al_pool_free (void *p, size_t size);
+
+#endif
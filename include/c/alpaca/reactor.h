@@ -0,0 +1,126 @@
+/* reactor.h
+ * ---------
+ * server loop threads.  each reactor owns a listening socket, a poller,
+ * and the connections it has accepted. */
+
+#ifndef __ALPACA_C_REACTOR_H
+#define __ALPACA_C_REACTOR_H
+
+#include <pthread.h>
+
+#include "defs.h"
+
+/* a single server loop. */
+struct _al_reactor_t {
+   /* internal stuff. */
+   al_flags_t state;
+   int index, sock_fd, wake_fd[2];
+   al_poll_t *poll;
+   al_server_t *server;
+
+   /* connections, and those awaiting attention from the loop. */
+   al_connection_t *connection_list, *pending_list;
+   int connection_count;
+
+   /* accept() counters (see al_server_get_stats()). */
+   unsigned long accepts, accept_wakeups, accept_budget_hits, accept_max;
+
+   /* memory held by our connections' input buffers, and the number of times
+    * one has reached its limit. */
+   size_t input_bytes;
+   unsigned long input_full;
+
+   /* memory held by our connections' queued output, and the number of
+    * times reading from a connection was paused to stay within the
+    * server's output budget. */
+   size_t output_bytes;
+   unsigned long read_pauses;
+
+   /* timers run from our loop, including connection timeouts. */
+   al_timer_wheel_t *timers;
+
+   /* set once we've been woken up, until our loop notices. */
+   int signalled;
+
+   /* connections by id.  slots of freed connections go on a free list
+    * starting at 'slot_free' (or -1) and are reused with a new generation,
+    * so stale ids never find anything. */
+   al_reactor_slot_t *slots;
+   int slot_count, slot_size, slot_free;
+
+   /* data posted by other threads for our connections.  posts are pushed
+    * onto 'post_list' without locking, newest first.  our loop takes the
+    * whole list at once and works through it oldest first from
+    * 'post_work'. */
+   al_reactor_post_t *post_list, *post_work;
+
+   /* threading stuff.  the mutex is shared with the server when it's the
+    * only reactor. */
+   pthread_t pthread;
+   al_mutex_t *mutex;
+};
+
+/* a connection's place in its reactor's id table. */
+struct _al_reactor_slot_t {
+   al_connection_t *connection;
+   uint32_t generation;
+   int next_free;
+};
+
+/* pulling connection ids apart. */
+#define AL_CONNECTION_ID_GENERATION(id) ((uint32_t) ((id) >> 32))
+#define AL_CONNECTION_ID_REACTOR(id)    ((int) (((id) >> 24) & 0xff))
+#define AL_CONNECTION_ID_SLOT(id)       ((int) ((id) & 0xffffff))
+
+/* data handed to a reactor from another thread.  the post holds its own
+ * reference to the buffer.  function posts have no buffer, submitted
+ * writes find their connection by 'id', and spliced writes only send the
+ * 'len' bytes of their buffer starting at 'pos'. */
+struct _al_reactor_post_t {
+   int type;
+   al_connection_t *connection;
+   al_connection_id_t id;
+   al_buffer_t *buffer;
+   size_t pos, len;
+   al_reactor_func *func;
+   void *arg;
+   al_reactor_post_t *next;
+};
+
+/* reactor management. */
+al_reactor_t *al_reactor_new (al_server_t *server, int index,
+   al_mutex_t *mutex);
+int al_reactor_free (al_reactor_t *r);
+int al_reactor_open (al_reactor_t *r, int sock_fd, int owns_socket);
+int al_reactor_close (al_reactor_t *r);
+int al_reactor_lock (al_reactor_t *r);
+int al_reactor_unlock (al_reactor_t *r);
+int al_reactor_start (al_reactor_t *r);
+int al_reactor_loop_func (al_reactor_t *r);
+void *al_reactor_pthread_func (void *arg);
+int al_reactor_interrupt (al_reactor_t *r);
+al_reactor_t *al_reactor_current (const al_server_t *server);
+
+/* writing to connections owned by a reactor. */
+int al_reactor_write (al_reactor_t *r, const unsigned char *buf,
+   size_t size);
+int al_reactor_write_buffer (al_reactor_t *r, al_buffer_t *b);
+int al_reactor_post (al_reactor_t *r, al_connection_t *c, int type,
+   const unsigned char *buf, size_t size);
+int al_reactor_post_buffer (al_reactor_t *r, al_connection_t *c, int type,
+   al_buffer_t *b);
+int al_reactor_post_splice (al_reactor_t *r, al_connection_t *c,
+   al_buffer_t *b, size_t pos, size_t len);
+int al_reactor_post_func (al_reactor_t *r, al_connection_t *c,
+   al_reactor_func *func, void *arg);
+int al_reactor_post_id (al_reactor_t *r, al_connection_id_t id,
+   al_buffer_t *b);
+int al_reactor_post_cancel (al_reactor_t *r, al_connection_t *c);
+
+/* connection ids. */
+al_connection_id_t al_reactor_id_new (al_reactor_t *r, al_connection_t *c);
+int al_reactor_id_free (al_reactor_t *r, al_connection_id_t id);
+al_connection_t *al_reactor_id_find (const al_reactor_t *r,
+   al_connection_id_t id);
+
+#endif
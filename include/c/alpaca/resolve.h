@@ -0,0 +1,62 @@
+/* resolve.h
+ * ---------
+ * background reverse DNS lookups with a cache of recent results. */
+
+#ifndef __ALPACA_C_RESOLVE_H
+#define __ALPACA_C_RESOLVE_H
+
+#include <pthread.h>
+#include <netinet/in.h>
+
+#include "defs.h"
+
+/* cache options.  negative results are remembered, too, but not for as
+ * long. */
+#define AL_RESOLVE_CACHE_SIZE      1024
+#define AL_RESOLVE_CACHE_TTL       300000
+#define AL_RESOLVE_CACHE_TTL_FAIL  60000
+#define AL_RESOLVE_HASH_SIZE       256
+#define AL_RESOLVE_HOST_MAX        1025
+
+/* a cached result, linked by hash and by how recently it was used. */
+struct _al_resolve_entry_t {
+   struct in_addr addr;
+   char *hostname;
+   unsigned long long expires;
+   al_resolve_entry_t *hash_next, *prev, *next;
+};
+
+/* an address waiting to be resolved for a connection. */
+struct _al_resolve_request_t {
+   struct in_addr addr;
+   al_connection_t *connection;
+   al_reactor_t *reactor;
+   al_resolve_request_t *next;
+};
+
+/* our resolver, running in its own thread. */
+struct _al_resolver_t {
+   al_flags_t state;
+   al_server_t *server;
+
+   /* requests waiting to be resolved, and the one being resolved. */
+   al_resolve_request_t *queue, *queue_last, *current;
+
+   /* cached results.  most recently used entries are at the front. */
+   al_resolve_entry_t *hash[AL_RESOLVE_HASH_SIZE];
+   al_resolve_entry_t *entry_list, *entry_last;
+   int entry_count;
+
+   /* threading stuff. */
+   pthread_t pthread;
+   pthread_mutex_t mutex;
+   pthread_cond_t cond;
+};
+
+/* resolver management. */
+al_resolver_t *al_resolver_new (al_server_t *server);
+int al_resolver_free (al_resolver_t *res);
+int al_resolver_request (al_resolver_t *res, al_connection_t *c);
+int al_resolver_cancel (al_resolver_t *res, al_connection_t *c);
+
+#endif
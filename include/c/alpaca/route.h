@@ -0,0 +1,45 @@
+/* route.h
+ * -------
+ * radix trie of URL paths for routing HTTP requests. */
+
+#ifndef __ALPACA_C_ROUTE_H
+#define __ALPACA_C_ROUTE_H
+
+#include "defs.h"
+
+/* a node in the route trie of a verb.  static nodes match their label
+ * exactly; parameters match up to the next '/' and wildcards match the rest
+ * of the path, capturing whatever they matched under their label. */
+struct _al_http_route_t {
+   int type;
+   char *label;
+   size_t label_len;
+
+   /* function for routes that end here. */
+   al_http_func_def_t *def;
+
+   /* static children are siblings with distinct first characters.  nodes
+    * have at most one parameter and one wildcard child. */
+   al_http_route_t *children, *param, *wildcard;
+   al_http_route_t *next;
+};
+
+/* a value captured while routing.  'value' points into the request's path
+ * and isn't terminated. */
+struct _al_http_param_t {
+   const char *name, *value;
+   size_t len;
+};
+
+/* route management. */
+al_http_route_t *al_http_route_add (al_http_t *http, const char *verb,
+   const char *pattern, al_http_func *func);
+al_http_func_def_t *al_http_route_match (const al_http_t *http,
+   al_http_state_t *state, const char *verb, const char *path);
+int al_http_route_free (al_http_route_t *r);
+
+/* captured parameters. */
+const al_http_param_t *al_http_param_get (const al_http_state_t *state,
+   const char *name);
+
+#endif
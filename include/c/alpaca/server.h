@@ -9,7 +9,6 @@
 #include <netinet/ip.h>
 #include <sys/types.h>
 #include <sys/socket.h>
-#include <sys/select.h>
 
 #include "defs.h"
 
@@ -27,20 +26,32 @@ struct _al_server_t {
    /* internal stuff. */
    al_flags_t state, flags;
    struct sockaddr_in addr;
-   int port, sock_fd, pipe_fd[2];
-   fd_set fd_in, fd_out, fd_other;
+   int port, backlog, accept_budget;
+
+   /* limit on unused input and output watermarks for new connections, and
+    * the most output all of our connections queue before slow ones stop
+    * reading. */
+   size_t input_max, output_high, output_low, output_budget;
 
    /* functions passed to servers. */
    al_server_func *func[AL_SERVER_FUNC_MAX];
 
-   /* connections. */
-   al_connection_t *connection_list;
+   /* server loops.  each reactor owns its own connections. */
+   al_reactor_t **reactors;
+   int reactor_count, reactors_running;
+
+   /* hostname lookups, if enabled. */
+   al_resolver_t *resolver;
+
+   /* threads for work that shouldn't hold up our loops, if wanted. */
+   al_workers_t *workers;
+   int worker_count, worker_queue_max;
 
-   /* custom data we're passing to the server. */
-   al_module_t *module_list;
+   /* custom data we're passing to the server, and the modules with a slot
+    * of their own (see al_module_register()). */
+   al_module_t *module_list, *module_slots[AL_MODULE_SLOTS];
 
    /* threading stuff. */
-   pthread_t pthread;
    al_mutex_t *mutex;
    int mutex_count;
     
@@ -48,16 +59,44 @@ struct _al_server_t {
    void *cpp_wrapper;
 };
 
+/* counters returned by al_server_get_stats(). */
+struct _al_server_stats_t {
+   /* connections accepted, wakeups with pending connections, wakeups that
+    * used up the accept budget, and most accepted in a single wakeup. */
+   unsigned long accepts, accept_wakeups, accept_budget_hits, accept_max;
+
+   /* connections waiting to be accepted and the backlog, from TCP_INFO. */
+   unsigned long listen_queue, listen_queue_max;
+
+   /* system-wide listen queue overflows and drops. */
+   unsigned long listen_overflows, listen_drops;
+
+   /* memory held by connection input buffers, and the number of times a
+    * connection's input has reached its limit. */
+   unsigned long input_bytes, input_full;
+
+   /* memory held by queued connection output, and the number of times a
+    * connection stopped reading to stay within the output budget. */
+   unsigned long output_bytes, read_pauses;
+};
+
 /* functions for server management. */
 al_server_t *al_server_new (int port, al_flags_t flags);
 int al_server_set_flags (al_server_t *server, int port, al_flags_t flags);
+int al_server_set_reactors (al_server_t *server, int count);
+int al_server_set_accept (al_server_t *server, int backlog, int budget);
+int al_server_set_workers (al_server_t *server, int count, int queue_max);
+int al_server_set_input_max (al_server_t *server, size_t max);
+int al_server_set_output_watermarks (al_server_t *server, size_t high,
+   size_t low);
+int al_server_set_output_budget (al_server_t *server, size_t budget);
+int al_server_get_stats (const al_server_t *server, al_server_stats_t *stats);
 int al_server_is_open (const al_server_t *server);
 int al_server_is_running (const al_server_t *server);
 int al_server_is_quitting (const al_server_t *server);
 int al_server_is_in_loop (const al_server_t *server);
 int al_server_close (al_server_t *server);
 int al_server_open (al_server_t *server);
-void *al_server_pthread_func (void *arg);
 int al_server_start (al_server_t *server);
 int al_server_wait (al_server_t *server);
 int al_server_run_func (al_server_t *server);
@@ -70,10 +109,19 @@ int al_server_func_set (al_server_t *server, int task, al_server_func *func);
 int al_server_write (al_server_t *server, const unsigned char *buf,
    size_t size);
 int al_server_write_string (al_server_t *server, const char *string);
+int al_server_write_buffer (al_server_t *server, al_buffer_t *b);
+int al_server_submit (al_server_t *server, al_connection_id_t id,
+   const unsigned char *buf, size_t size);
+int al_server_submit_buffer (al_server_t *server, al_connection_id_t id,
+   al_buffer_t *b);
 al_module_t *al_server_module_new (al_server_t *server, const char *name,
    void *data, size_t data_size, al_module_func *free_func);
 al_module_t *al_server_module_get (const al_server_t *server,
    const char *name);
+al_module_t *al_server_module_slot (const al_server_t *server, int id);
+int al_server_timer_set (al_server_t *server, al_timer_t *timer,
+   unsigned long ms);
 int al_server_in_thread (const al_server_t *server);
+int al_server_reactor_index (const al_server_t *server);
 
 #endif
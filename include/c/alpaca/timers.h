@@ -0,0 +1,54 @@
+/* timers.h
+ * --------
+ * hierarchical timer wheels driven by a monotonic clock. */
+
+#ifndef __ALPACA_C_TIMERS_H
+#define __ALPACA_C_TIMERS_H
+
+#include "defs.h"
+
+/* wheel dimensions.  each level has 64 slots, each slot covering 64 times
+ * the time of a slot in the level below.  with millisecond ticks, five
+ * levels cover a little over 12 days. */
+#define AL_TIMER_BITS      6
+#define AL_TIMER_SLOTS     (1 << AL_TIMER_BITS)
+#define AL_TIMER_MASK      (AL_TIMER_SLOTS - 1)
+#define AL_TIMER_LEVELS    5
+
+/* a single timer.  can be allocated with al_timer_new() or embedded in
+ * other structures and prepared with al_timer_init(). */
+struct _al_timer_t {
+   unsigned long long expires;
+
+   /* function called once the timer expires. */
+   al_timer_func *func;
+   void *arg;
+
+   /* wheel slot we're linked to while active. */
+   al_timer_wheel_t *wheel;
+   al_timer_t **list, *prev, *next;
+};
+
+/* a collection of timers, advanced by the owner's loop. */
+struct _al_timer_wheel_t {
+   unsigned long long now;
+   al_timer_t *slots[AL_TIMER_LEVELS][AL_TIMER_SLOTS];
+   int count;
+};
+
+/* timer wheel management. */
+al_timer_wheel_t *al_timer_wheel_new (void);
+int al_timer_wheel_free (al_timer_wheel_t *w);
+int al_timer_wheel_run (al_timer_wheel_t *w);
+long al_timer_wheel_next (const al_timer_wheel_t *w);
+
+/* functions for individual timers. */
+al_timer_t *al_timer_new (al_timer_func *func, void *arg);
+int al_timer_init (al_timer_t *t, al_timer_func *func, void *arg);
+int al_timer_free (al_timer_t *t);
+int al_timer_set (al_timer_wheel_t *w, al_timer_t *t, unsigned long ms);
+int al_timer_cancel (al_timer_t *t);
+int al_timer_is_active (const al_timer_t *t);
+unsigned long long al_timer_clock (void);
+
+#endif
@@ -9,9 +9,11 @@
 
 #include <stdarg.h>
 
-/* URIs passed to HTTP functions. */
+/* URIs passed to HTTP functions.  URIs built in an arena allocate
+ * everything from it and are released along with it. */
 struct _al_uri_t {
    al_flags_t flags;
+   al_arena_t *arena;
 
    /* strings, broken down to full path and query. */
    char *str_full, *str_path, *str_query;
@@ -35,6 +37,7 @@ struct _al_uri_parameter_t {
 
 /* URI functions. */
 al_uri_t *al_uri_new (const char *string);
+al_uri_t *al_uri_new_arena (al_arena_t *arena, const char *string);
 int al_uri_free (al_uri_t *uri);
 char *al_uri_decode (const char *input, char *output, size_t output_size);
 
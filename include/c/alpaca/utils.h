@@ -78,4 +78,42 @@ int al_util_replace_string (char **dst, const char *src);
 #define AL_MIN(x, y) \
    (((x) < (y)) ? (x) : (y))
 
+/* atomic operations for data shared between threads without locking. */
+#ifdef __ATOMIC_SEQ_CST
+   #define AL_ATOMIC_LOAD(ptr) \
+      __atomic_load_n ((ptr), __ATOMIC_SEQ_CST)
+   #define AL_ATOMIC_STORE(ptr, val) \
+      __atomic_store_n ((ptr), (val), __ATOMIC_SEQ_CST)
+   #define AL_ATOMIC_EXCHANGE(ptr, val) \
+      __atomic_exchange_n ((ptr), (val), __ATOMIC_SEQ_CST)
+   #define AL_ATOMIC_ADD(ptr, val) \
+      __atomic_add_fetch ((ptr), (val), __ATOMIC_SEQ_CST)
+   #define AL_ATOMIC_SUB(ptr, val) \
+      __atomic_sub_fetch ((ptr), (val), __ATOMIC_SEQ_CST)
+   #define AL_ATOMIC_CAS(ptr, old, val) \
+      __sync_bool_compare_and_swap ((ptr), (old), (val))
+   #define AL_ATOMIC_OR(ptr, val) \
+      __atomic_or_fetch ((ptr), (val), __ATOMIC_SEQ_CST)
+   #define AL_ATOMIC_AND(ptr, val) \
+      __atomic_and_fetch ((ptr), (val), __ATOMIC_SEQ_CST)
+#else
+   #define AL_ATOMIC_LOAD(ptr) \
+      __sync_add_and_fetch ((ptr), 0)
+   #define AL_ATOMIC_STORE(ptr, val) \
+      do { __sync_synchronize (); *(ptr) = (val); __sync_synchronize (); } \
+      while (0)
+   #define AL_ATOMIC_EXCHANGE(ptr, val) \
+      (__sync_synchronize (), __sync_lock_test_and_set ((ptr), (val)))
+   #define AL_ATOMIC_ADD(ptr, val) \
+      __sync_add_and_fetch ((ptr), (val))
+   #define AL_ATOMIC_SUB(ptr, val) \
+      __sync_sub_and_fetch ((ptr), (val))
+   #define AL_ATOMIC_CAS(ptr, old, val) \
+      __sync_bool_compare_and_swap ((ptr), (old), (val))
+   #define AL_ATOMIC_OR(ptr, val) \
+      __sync_or_and_fetch ((ptr), (val))
+   #define AL_ATOMIC_AND(ptr, val) \
+      __sync_and_and_fetch ((ptr), (val))
+#endif
+
 #endif
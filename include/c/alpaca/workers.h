@@ -0,0 +1,45 @@
+/* workers.h
+ * ---------
+ * pool of threads for running work off of the server loops. */
+
+#ifndef __ALPACA_C_WORKERS_H
+#define __ALPACA_C_WORKERS_H
+
+#include <pthread.h>
+
+#include "defs.h"
+
+/* work waiting for a thread.  jobs with the same key run one at a time, in
+ * the order they were submitted. */
+struct _al_worker_job_t {
+   const void *key;
+   al_worker_func *func;
+   void *arg;
+   al_worker_job_t *next;
+};
+
+/* our pool of threads, sharing a single queue. */
+struct _al_workers_t {
+   al_flags_t state;
+   al_server_t *server;
+
+   /* jobs waiting for a thread, and the keys of the jobs being run. */
+   al_worker_job_t *queue, *queue_last;
+   int queue_count, queue_max;
+   const void **busy;
+
+   /* threading stuff. */
+   pthread_t *pthreads;
+   int thread_count;
+   pthread_mutex_t mutex;
+   pthread_cond_t cond;
+};
+
+/* pool management. */
+al_workers_t *al_workers_new (al_server_t *server, int threads,
+   int queue_max);
+int al_workers_free (al_workers_t *w);
+int al_workers_submit (al_workers_t *w, const void *key,
+   al_worker_func *func, void *arg);
+
+#endif
@@ -13,6 +13,8 @@ class AlpacaConnection {
 //public:
 private:
     al_connection_t *connection;
+    al_server_t *server;
+    al_connection_id_t id;          // Used for writing, so writes from any thread never reach a freed connection
     friend class AlpacaServer;      // Gives AlpacaServer access to private members of AlpacaConnection (e.g. the al_connection_t* pointer)
     
 public:
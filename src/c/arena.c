@@ -0,0 +1,126 @@
+/* arena.c
+ * -------
+ * bump-pointer allocation for data that's all released at once. */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "alpaca/arena.h"
+
+static al_arena_block_t *al_arena_block_new (size_t size)
+{
+   /* our data comes right after the block itself. */
+   al_arena_block_t *new = malloc (sizeof (al_arena_block_t) + size);
+   new->size = size;
+   new->used = 0;
+   new->next = NULL;
+   new->data = (unsigned char *) (new + 1);
+   return new;
+}
+
+/* al_arena_init():
+ * ----------------
+ * Prepares an arena embedded in another structure.  Nothing is allocated
+ * until it's needed.
+ *
+ * block_size: Size of each block, or 0 for AL_ARENA_BLOCK_SIZE.
+ */
+int al_arena_init (al_arena_t *a, size_t block_size)
+{
+   memset (a, 0, sizeof (al_arena_t));
+   a->block_size = block_size ? block_size : AL_ARENA_BLOCK_SIZE;
+   return 1;
+}
+
+/* al_arena_alloc():
+ * -----------------
+ * Return value: 'size' bytes of uninitialized memory belonging to the
+ *               arena.  It can't be freed on its own.
+ */
+void *al_arena_alloc (al_arena_t *a, size_t size)
+{
+   al_arena_block_t *b;
+   uintptr_t addr;
+   size_t pad;
+
+   /* large allocations get a block of their own. */
+   if (size > a->block_size / 2) {
+      b = al_arena_block_new (size);
+      b->used = size;
+      b->next  = a->large;
+      a->large = b;
+      return b->data;
+   }
+
+   /* move on to the next block when this one is full, reusing blocks from
+    * before the last reset. */
+   while (1) {
+      if ((b = a->current) != NULL) {
+         addr = (uintptr_t) (b->data + b->used);
+         pad  = (AL_ARENA_ALIGN - (addr % AL_ARENA_ALIGN)) % AL_ARENA_ALIGN;
+         if (b->used + pad + size <= b->size) {
+            b->used += pad + size;
+            return (void *) (addr + pad);
+         }
+         if (b->next == NULL)
+            b->next = al_arena_block_new (a->block_size);
+         a->current = b->next;
+      }
+      else if (a->first == NULL)
+         a->current = a->first = al_arena_block_new (a->block_size);
+      else
+         a->current = a->first;
+      a->current->used = 0;
+   }
+}
+
+void *al_arena_calloc (al_arena_t *a, size_t size)
+   { return memset (al_arena_alloc (a, size), 0, size); }
+
+char *al_arena_strdup (al_arena_t *a, const char *string)
+   { return al_arena_strndup (a, string, strlen (string)); }
+
+char *al_arena_strndup (al_arena_t *a, const char *string, size_t len)
+{
+   char *new = al_arena_alloc (a, len + 1);
+   memcpy (new, string, len);
+   new[len] = '\0';
+   return new;
+}
+
+/* al_arena_reset():
+ * -----------------
+ * Releases everything allocated from an arena.  Blocks are kept and used
+ * again from the start.
+ */
+int al_arena_reset (al_arena_t *a)
+{
+   al_arena_block_t *b;
+
+   while ((b = a->large) != NULL) {
+      a->large = b->next;
+      free (b);
+   }
+   a->current = a->first;
+   if (a->current)
+      a->current->used = 0;
+   return 1;
+}
+
+/* al_arena_clear():
+ * -----------------
+ * Releases everything allocated from an arena and frees its blocks.
+ */
+int al_arena_clear (al_arena_t *a)
+{
+   al_arena_block_t *b;
+
+   al_arena_reset (a);
+   while ((b = a->first) != NULL) {
+      a->first = b->next;
+      free (b);
+   }
+   a->current = NULL;
+   return 1;
+}
@@ -0,0 +1,315 @@
+/* buffer.c
+ * --------
+ * refcounted buffers and queues of buffer segments for scatter/gather
+ * output. */
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "alpaca/buffer.h"
+#include "alpaca/pool.h"
+
+/* al_buffer_new():
+ * ----------------
+ * Allocates an empty buffer with room for at least 'size' bytes, taken from
+ * our pool ('b->size' is all the room it has).  The buffer starts with one
+ * reference, belonging to the caller.
+ */
+al_buffer_t *al_buffer_new (size_t size)
+{
+   al_buffer_t *new;
+
+   size = al_pool_size (size ? size : 1);
+   new = al_buffer_take (al_pool_alloc (size), 0, size);
+   new->flags = AL_BUFFER_POOLED;
+   return new;
+}
+
+/* al_buffer_take():
+ * -----------------
+ * Creates a buffer from memory allocated with malloc().  The buffer takes
+ * ownership of 'data' and frees it once released.
+ *
+ * data: Memory from malloc().
+ * len:  Number of bytes in use.
+ * size: Number of bytes allocated.
+ */
+al_buffer_t *al_buffer_take (unsigned char *data, size_t len, size_t size)
+{
+   al_buffer_t *new = al_pool_calloc (sizeof (al_buffer_t));
+   new->flags = AL_BUFFER_OWNED;
+   new->fd    = -1;
+   new->data  = data;
+   new->len   = len;
+   new->size  = size;
+   new->refs  = 1;
+   return new;
+}
+
+/* al_buffer_wrap():
+ * -----------------
+ * Creates a buffer referencing memory that belongs to the caller.  'data'
+ * must not change until 'free_func' is called.  Static data doesn't need a
+ * function at all.
+ *
+ * free_func: Optional function called once the last reference is dropped.
+ * arg:       Data passed to 'free_func'.
+ *
+ * Function hook type definition (al_buffer_func):
+ * -----------------------------------------------
+ * AL_BUFFER_FUNC (foo)  <-- parameters are (buffer, arg)
+ */
+al_buffer_t *al_buffer_wrap (const unsigned char *data, size_t len,
+   al_buffer_func *free_func, void *arg)
+{
+   al_buffer_t *new = al_pool_calloc (sizeof (al_buffer_t));
+   new->fd        = -1;
+   new->data      = (unsigned char *) data;
+   new->len       = len;
+   new->size      = len;
+   new->refs      = 1;
+   new->free_func = free_func;
+   new->arg       = arg;
+   return new;
+}
+
+/* al_buffer_file():
+ * -----------------
+ * Creates a buffer for 'len' bytes of a file starting at 'offset'.  Segments
+ * of file buffers are written on their own with sendfile() rather than being
+ * gathered with others.
+ *
+ * flags: AL_BUFFER_CLOSE to close 'fd' once the buffer is released.
+ */
+al_buffer_t *al_buffer_file (int fd, off_t offset, size_t len,
+   al_flags_t flags)
+{
+   al_buffer_t *new = al_pool_calloc (sizeof (al_buffer_t));
+   new->flags  = AL_BUFFER_FILE | (flags & AL_BUFFER_CLOSE);
+   new->fd     = fd;
+   new->offset = offset;
+   new->len    = len;
+   new->size   = len;
+   new->refs   = 1;
+   return new;
+}
+
+/* al_buffer_ref():
+ * al_buffer_unref():
+ * ------------------
+ * Adds or drops a reference to a buffer.  References may be dropped from any
+ * thread; the buffer is freed along with the last one.
+ *
+ * Return value: al_buffer_ref() returns 'b'.  al_buffer_unref() returns 1 if
+ *               the buffer was freed, otherwise 0.
+ */
+al_buffer_t *al_buffer_ref (al_buffer_t *b)
+{
+   AL_ATOMIC_ADD (&(b->refs), 1);
+   return b;
+}
+
+int al_buffer_unref (al_buffer_t *b)
+{
+   if (AL_ATOMIC_SUB (&(b->refs), 1) > 0)
+      return 0;
+   if (b->free_func)
+      b->free_func (b, b->arg);
+   if (b->flags & AL_BUFFER_OWNED)
+      free (b->data);
+   else if (b->flags & AL_BUFFER_POOLED)
+      al_pool_free (b->data, b->size);
+   if (b->flags & AL_BUFFER_CLOSE)
+      close (b->fd);
+   al_pool_free (b, sizeof (al_buffer_t));
+   return 1;
+}
+
+/* al_buffer_queue_append():
+ * -------------------------
+ * Queues 'len' bytes of a buffer starting at 'pos'.  The queue takes its own
+ * reference; the caller's reference is untouched.
+ *
+ * Return value: 1 on success, 0 if there was nothing to queue.
+ */
+int al_buffer_queue_append (al_buffer_queue_t *q, al_buffer_t *b, size_t pos,
+   size_t len)
+{
+   al_buffer_seg_t *s;
+
+   if (len == 0)
+      return 0;
+
+   s = al_pool_alloc (sizeof (al_buffer_seg_t));
+   s->buffer = al_buffer_ref (b);
+   s->pos    = pos;
+   s->len    = pos + len;
+   s->next   = NULL;
+
+   /* link to the back of our queue. */
+   if (q->last)
+      q->last->next = s;
+   else
+      q->first = s;
+   q->last = s;
+   q->len += len;
+   q->count++;
+   return 1;
+}
+
+/* al_buffer_queue_copy():
+ * -----------------------
+ * Queues a copy of 'data'.  If the last segment ends a buffer nobody else is
+ * using, the copy is packed into whatever room is left after it.
+ *
+ * Return value: 1 on success, 0 if there was nothing to queue.
+ */
+int al_buffer_queue_copy (al_buffer_queue_t *q, const unsigned char *data,
+   size_t len)
+{
+   al_buffer_seg_t *s;
+   al_buffer_t *b;
+   size_t room;
+   int res;
+
+   if (data == NULL || len == 0)
+      return 0;
+
+   /* can we fit into the end of our last buffer? */
+   if ((s = q->last) != NULL) {
+      b = s->buffer;
+      if ((b->flags & (AL_BUFFER_OWNED | AL_BUFFER_POOLED)) &&
+          s->len == b->len &&
+          AL_ATOMIC_LOAD (&(b->refs)) == 1) {
+         room = AL_MIN (b->size - b->len, len);
+         memcpy (b->data + b->len, data, room);
+         b->len += room;
+         s->len += room;
+         q->len += room;
+         data   += room;
+         len    -= room;
+         if (len == 0)
+            return 1;
+      }
+   }
+
+   /* copy the rest into a new buffer. */
+   b = al_buffer_new (AL_MAX (len, AL_BUFFER_MIN_SIZE));
+   memcpy (b->data, data, len);
+   b->len = len;
+   res = al_buffer_queue_append (q, b, 0, len);
+   al_buffer_unref (b);
+   return res;
+}
+
+/* al_buffer_queue_splice():
+ * -------------------------
+ * Moves every segment of 'src' to the back of 'dst' without copying,
+ * leaving 'src' empty.
+ *
+ * Return value: The number of segments moved.
+ */
+int al_buffer_queue_splice (al_buffer_queue_t *dst, al_buffer_queue_t *src)
+{
+   int count = src->count;
+
+   if (src->first == NULL)
+      return 0;
+   if (dst->last)
+      dst->last->next = src->first;
+   else
+      dst->first = src->first;
+   dst->last   = src->last;
+   dst->len   += src->len;
+   dst->count += src->count;
+
+   src->first = src->last = NULL;
+   src->len   = 0;
+   src->count = 0;
+   return count;
+}
+
+/* al_buffer_queue_iov():
+ * ----------------------
+ * Describes the front of a queue for writev(), stopping at the first file
+ * segment.
+ *
+ * iov:     Array to fill.
+ * iov_max: Number of entries in 'iov'.
+ * max:     Maximum number of bytes to describe.
+ *
+ * Return value: The number of entries filled.
+ */
+int al_buffer_queue_iov (const al_buffer_queue_t *q, struct iovec *iov,
+   int iov_max, size_t max)
+{
+   al_buffer_seg_t *s;
+   size_t len;
+   int count;
+
+   for (s = q->first, count = 0; s != NULL && count < iov_max && max > 0;
+        s = s->next, count++) {
+      if (s->buffer->flags & AL_BUFFER_FILE)
+         break;
+      len = AL_MIN (s->len - s->pos, max);
+      iov[count].iov_base = s->buffer->data + s->pos;
+      iov[count].iov_len  = len;
+      max -= len;
+   }
+   return count;
+}
+
+/* al_buffer_queue_consume():
+ * --------------------------
+ * Removes 'bytes' bytes from the front of a queue, dropping segments that
+ * have been used up.
+ *
+ * Return value: The number of bytes removed.
+ */
+size_t al_buffer_queue_consume (al_buffer_queue_t *q, size_t bytes)
+{
+   al_buffer_seg_t *s;
+   size_t total, len;
+
+   total = 0;
+   while ((s = q->first) != NULL && bytes > 0) {
+      len = AL_MIN (s->len - s->pos, bytes);
+      s->pos += len;
+      q->len -= len;
+      bytes  -= len;
+      total  += len;
+
+      /* is this segment done? */
+      if (s->pos < s->len)
+         break;
+      if ((q->first = s->next) == NULL)
+         q->last = NULL;
+      q->count--;
+      al_buffer_unref (s->buffer);
+      al_pool_free (s, sizeof (al_buffer_seg_t));
+   }
+   return total;
+}
+
+/* al_buffer_queue_clear():
+ * ------------------------
+ * Drops everything in a queue.
+ *
+ * Return value: The number of segments dropped.
+ */
+int al_buffer_queue_clear (al_buffer_queue_t *q)
+{
+   al_buffer_seg_t *s;
+   int count;
+
+   for (count = 0; (s = q->first) != NULL; count++) {
+      q->first = s->next;
+      al_buffer_unref (s->buffer);
+      al_pool_free (s, sizeof (al_buffer_seg_t));
+   }
+   q->last  = NULL;
+   q->len   = 0;
+   q->count = 0;
+   return count;
+}
@@ -2,60 +2,132 @@
  * -------------
  * connection management for servers. */
 
+/* pread() and sigtimedwait() aren't available in strict C99. */
+#define _POSIX_C_SOURCE 200809L
+
+#ifdef HAVE_CONFIG_H
+   #include "config.h"
+#endif
+
 #include <arpa/inet.h>
+#ifdef HAVE_SYS_IOCTL_H
+   #include <sys/ioctl.h>
+#endif
 #include <sys/socket.h>
 #include <sys/time.h>
+#include <sys/uio.h>
+#ifdef HAVE_SYS_SENDFILE_H
+   #include <sys/sendfile.h>
+#endif
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
-#include <netdb.h>
 
 #include "alpaca/modules.h"
+#include "alpaca/poll.h"
+#include "alpaca/pool.h"
+#include "alpaca/reactor.h"
+#include "alpaca/read.h"
+#include "alpaca/resolve.h"
 #include "alpaca/server.h"
 
 #include "alpaca/connections.h"
 
+/* most segments written with a single call. */
+#ifdef IOV_MAX
+   #define AL_CONNECTION_IOV_MAX  IOV_MAX
+#else
+   #define AL_CONNECTION_IOV_MAX  1024
+#endif
+
+static void al_connection_input_resize (al_connection_t *c, size_t size);
+
+static AL_TIMER_FUNC (al_connection_timeout_func)
+{
+   al_connection_t *c = arg;
+   al_server_t *server = c->server;
+
+   /* let our server know before we close. */
+   c->flags |= AL_CONNECTION_TIMED_OUT;
+   if (server->func[AL_SERVER_FUNC_TIMEOUT])
+      server->func[AL_SERVER_FUNC_TIMEOUT] (server, c,
+         AL_SERVER_FUNC_TIMEOUT, 0);
+   al_connection_free (c);
+   return 0;
+}
+
 al_connection_t *al_connection_new (al_server_t *server, int fd_in, int fd_out,
    const struct sockaddr_in *addr, socklen_t addr_size, al_flags_t flags)
 {
    al_connection_t *new;
+   al_reactor_t *r;
 
-   /* allocate and assign data. */
-   new = calloc (1, sizeof (al_connection_t));
+   /* allocate and assign data.  connections come and go often enough to
+    * come from our pool. */
+   new = al_pool_calloc (sizeof (al_connection_t));
    new->fd_in   = fd_in;
    new->fd_out  = fd_out;
    new->flags   = flags;
+   al_timer_init (&(new->timeout), al_connection_timeout_func, new);
 
    if (addr) {
-      new->addr      = malloc (addr_size);
-      *(new->addr)   = *addr;
+      new->addr_data = *addr;
+      new->addr      = &(new->addr_data);
       new->addr_size = addr_size;
 
       /* record IP address. */
-      char ip[INET_ADDRSTRLEN];
-      const char *ip_ptr;
-      ip_ptr = inet_ntop (AF_INET, &(addr->sin_addr), ip, INET_ADDRSTRLEN);
-      if (ip_ptr)
-         new->ip_address = strdup (ip_ptr);
-
-      /* get domain name. */
-      struct hostent *host = gethostbyaddr ((char *) &(addr->sin_addr),
-         sizeof (addr->sin_addr), AF_INET);
-      if (host && host->h_name)
-         new->hostname = strdup (host->h_name);
+      if (inet_ntop (AF_INET, &(addr->sin_addr), new->ip_data,
+                     INET_ADDRSTRLEN))
+         new->ip_address = new->ip_data;
+   }
+
+   /* connections belong to the reactor that accepted them.  connections
+    * created outside of a reactor thread go to the first one. */
+   if ((r = al_reactor_current (server)) == NULL)
+      r = server->reactors[0];
+
+   /* link to our reactor. */
+   al_reactor_lock (r);
+   new->server = server;
+   AL_LL_LINK_FRONT (new, reactor, prev, next, r, connection_list);
+   AL_ATOMIC_ADD (&(r->connection_count), 1);
+   new->id        = al_reactor_id_new (r, new);
+   new->input_max   = server->input_max;
+   new->output_high = server->output_high;
+   new->output_low  = server->output_low;
+
+   /* register our descriptors with the reactor's poller.  interest for
+    * output is added once there's something to write. */
+   if (r->poll) {
+      int added = (new->fd_in < 0) ||
+         al_poll_add (r->poll, new->fd_in, AL_POLL_IN, new);
+      if (added && new->fd_out >= 0 && new->fd_out != new->fd_in)
+         added = al_poll_add (r->poll, new->fd_out, 0, new);
+      if (!added) {
+         al_connection_free (new);
+         al_reactor_unlock (r);
+         return NULL;
+      }
+      new->poll_events = (new->fd_in >= 0) ? AL_POLL_IN : 0;
    }
 
-   /* link to our server. */
-   al_server_lock (server);
-   AL_LL_LINK_FRONT (new, server, prev, next, server, connection_list);
+   /* look up our domain name in the background, if we want it. */
+   if (new->addr && server->resolver)
+      al_resolver_request (server->resolver, new);
+
    if (server->func[AL_SERVER_FUNC_JOIN])
       if (!server->func[AL_SERVER_FUNC_JOIN] (server, new,
            AL_SERVER_FUNC_JOIN, NULL)) {
          al_connection_free (new);
+         al_reactor_unlock (r);
          return NULL;
       }
-   al_server_unlock (server);
+   al_reactor_unlock (r);
 
    /* return our new connection. */
    return new;
@@ -64,10 +136,12 @@ al_connection_t *al_connection_new (al_server_t *server, int fd_in, int fd_out,
 int al_connection_free (al_connection_t *c)
 {
    al_server_t *server;
+   al_reactor_t *r;
 
    /* boo race conditions! */
    server = c->server;
-   al_server_lock (server);
+   r      = c->reactor;
+   al_reactor_lock (r);
 
    /* function for leaving? */
    if (server->func[AL_SERVER_FUNC_LEAVE])
@@ -81,6 +155,19 @@ int al_connection_free (al_connection_t *c)
    while (c->module_list)
       al_module_free (c->module_list);
 
+   /* stop polling and forget about pending work. */
+   if (r->poll) {
+      al_poll_remove (r->poll, c->fd_in);
+      if (c->fd_out != c->fd_in)
+         al_poll_remove (r->poll, c->fd_out);
+   }
+   if (c->flags & AL_CONNECTION_PENDING)
+      AL_LL_UNLINK_GLOBAL (c, pending_prev, pending_next, r->pending_list);
+   if (server->resolver)
+      al_resolver_cancel (server->resolver, c);
+   al_reactor_post_cancel (r, c);
+   al_timer_cancel (&(c->timeout));
+
    /* close our socket. */
    if (!(c->flags & AL_CONNECTION_KEEP_OPEN)) {
       if (c->fd_in  >= 0)
@@ -90,27 +177,36 @@ int al_connection_free (al_connection_t *c)
    }
 
    /* free all other allocated memory. */
-   if (c->addr)       free (c->addr);
-   if (c->input)      free (c->input);
-   if (c->output)     free (c->output);
-   if (c->ip_address) free (c->ip_address);
+   if (c->input)      al_connection_input_resize (c, 0);
+   AL_ATOMIC_SUB (&(r->output_bytes), c->output.len);
+   al_buffer_queue_clear (&(c->output));
    if (c->hostname)   free (c->hostname);
 
    /* unlink. */
-   AL_LL_UNLINK (c, prev, next, c->server, connection_list);
+   AL_LL_UNLINK (c, prev, next, c->reactor, connection_list);
+   AL_ATOMIC_SUB (&(r->connection_count), 1);
+   al_reactor_id_free (r, c->id);
 
    /* free remaining data and return success. */
-   free (c);
-   al_server_unlock (server);
+   al_pool_free (c, sizeof (al_connection_t));
+   al_reactor_unlock (r);
    return 1;
 }
 
+int al_connection_lock (al_connection_t *c)
+   { return al_reactor_lock (c->reactor); }
+int al_connection_unlock (al_connection_t *c)
+   { return al_reactor_unlock (c->reactor); }
+
 int al_connection_close (al_connection_t *c)
 {
    /* fail if already being closed. */
    if (c->flags & AL_CONNECTION_CLOSING)
       return 0;
    c->flags |= AL_CONNECTION_CLOSING;
+
+   /* let the server loop stop reading and free us once output is sent. */
+   al_connection_pending (c);
    return 1;
 }
 
@@ -124,8 +220,10 @@ int al_connection_append_buffer (al_connection_t *c, unsigned char **buf,
    if (input == NULL || isize == 0)
       return 0;
 
-   /* don't allow reading while we're doing this. */
-   al_server_lock (c->server);
+   /* don't allow reading while we're doing this.  buffers that don't
+    * belong to a connection aren't locked. */
+   if (c)
+      al_connection_lock (c);
 
    /* how large should our buffer be?  use a sensible size for starting. */
    if (*buf == NULL)
@@ -153,7 +251,8 @@ int al_connection_append_buffer (al_connection_t *c, unsigned char **buf,
    *((*buf) + *len) = 0;
 
    /* we did it, you guise! */
-   al_server_unlock (c->server);
+   if (c)
+      al_connection_unlock (c);
    return 1;
 }
 
@@ -168,19 +267,19 @@ int al_connection_fetch_buffer (al_connection_t *c, const unsigned char **buf,
       return 0;
 
    /* don't allow writing while we're doing this. */
-   al_server_lock (c->server);
+   al_connection_lock (c);
 
    /* ...and don't bother if there's nothing to read. */
    input_len = *len - *pos;
    if (*buf == NULL || input_len <= 0) {
-      al_server_unlock (c->server);
+      al_connection_unlock (c);
       return 0;
    }
    /* are we only reading a portion? */
    else if (osize < input_len) {
       memcpy (output, *buf + *pos, sizeof (unsigned char) * osize);
       *pos += osize;
-      al_server_unlock (c->server);
+      al_connection_unlock (c);
       return osize;
    }
    /* looks like we're reading everything! */
@@ -190,7 +289,7 @@ int al_connection_fetch_buffer (al_connection_t *c, const unsigned char **buf,
       /* reset our buffer and return the number of bytes we read. */
       *len = 0;
       *pos = 0;
-      al_server_unlock (c->server);
+      al_connection_unlock (c);
       return input_len;
    }
 }
@@ -202,63 +301,338 @@ int al_connection_read (al_connection_t *c, unsigned char *buf, size_t size)
       &(c->input_size), &(c->input_len), &(c->input_pos), buf, size);
 }
 
+/* resize our input buffer (freeing it at zero), keeping track of how much
+ * input our reactor is holding on to. */
+static void al_connection_input_resize (al_connection_t *c, size_t size)
+{
+   if (size > c->input_size)
+      AL_ATOMIC_ADD (&(c->reactor->input_bytes), size - c->input_size);
+   else
+      AL_ATOMIC_SUB (&(c->reactor->input_bytes), c->input_size - size);
+   if (size == 0) {
+      al_pool_free (c->input, c->input_size);
+      c->input = NULL;
+   }
+   else
+      c->input = al_pool_realloc (c->input, c->input_size, size,
+         c->input_len + 1);
+   c->input_size = size;
+}
+
+/* move input that hasn't been used yet to the front of our buffer. */
+static void al_connection_input_compact (al_connection_t *c)
+{
+   if (c->input_pos == 0)
+      return;
+   memmove (c->input, c->input + c->input_pos, c->input_len - c->input_pos);
+   c->input_len -= c->input_pos;
+   c->input_pos  = 0;
+   c->input[c->input_len] = 0;
+}
+
+/* our unused input has reached its limit.  let our server decide whether
+ * to raise it; otherwise, stop reading and close. */
+static int al_connection_input_full (al_connection_t *c)
+{
+   al_server_t *server = c->server;
+
+   AL_ATOMIC_ADD (&(c->reactor->input_full), 1);
+   if (server->func[AL_SERVER_FUNC_INPUT_FULL] &&
+       server->func[AL_SERVER_FUNC_INPUT_FULL] (server, c,
+          AL_SERVER_FUNC_INPUT_FULL, NULL) &&
+       (c->input_max == 0 || c->input_len - c->input_pos < c->input_max))
+      return 1;
+   al_connection_close (c);
+   return 0;
+}
+
+/* al_connection_fd_read():
+ * -------------------------
+ * Reads straight into the spare room at the end of our input buffer.  The
+ * size of each read follows the size of recent ones: it doubles whenever a
+ * read fills the room we gave it and halves when reads come in well short.
+ * After a full read, we also ask the kernel how much is waiting, so bulk
+ * transfers catch up in a single read.
+ *
+ * Input that's been used is dropped from the front of the buffer before it
+ * grows, and unused input never goes past the connection's 'input_max'
+ * (see al_connection_set_input_max()).
+ *
+ * Return value: The number of bytes read, 0 if there was nothing to read,
+ *               or -1 if the connection has been closed.
+ */
 int al_connection_fd_read (al_connection_t *c)
 {
-   static unsigned char buf[4096];
+   size_t want, room, unused, new_size;
+   ssize_t res;
 
    /* do nothing if there's no descriptor for reading. */
    if (c->fd_in < 0)
       return -1;
 
+   /* how much do we expect? */
+   if (c->input_hint == 0)
+      c->input_hint = AL_CONNECTION_READ_MIN;
+   want = c->input_hint;
+#ifdef FIONREAD
+   int waiting;
+   if ((c->flags & AL_CONNECTION_READ_FILLED) &&
+       ioctl (c->fd_in, FIONREAD, &waiting) == 0 && (size_t) waiting > want)
+      want = AL_MIN ((size_t) waiting, AL_CONNECTION_READ_MAX);
+#endif
+
+   /* don't hold on to more than we're allowed. */
+   unused = c->input_len - c->input_pos;
+   if (c->input_max > 0 && unused >= c->input_max &&
+       !al_connection_input_full (c))
+      return 0;
+   if (c->input_max > 0)
+      want = AL_MIN (want, c->input_max - unused);
+
+   /* make room at the end of our input, keeping a byte to null-terminate
+    * it, just in case.  if there's room enough once used input is gone,
+    * there's no need to grow. */
+   al_connection_lock (c);
+   if (c->input_size < c->input_len + want + 1)
+      al_connection_input_compact (c);
+   if (c->input_size < c->input_len + want + 1) {
+      new_size = c->input_size ? c->input_size : 256;
+      while (new_size < c->input_len + want + 1)
+         new_size *= 2;
+      al_connection_input_resize (c, new_size);
+   }
+   room = c->input_size - c->input_len - 1;
+   al_connection_unlock (c);
+
    /* attempt to read.  if it didn't work, the connection has been closed.
     * return -1 to indicate an error. */
-   int res;
-   if ((res = read (c->fd_in, buf, 4096)) <= 0) {
-      unsigned char *ib;
-      ib = malloc (c->input_len + 1);
-      memcpy (ib, c->input, c->input_len);
-      ib[c->input_len] = '\0';
-      free (ib);
+   if ((res = read (c->fd_in, c->input + c->input_len, room)) <= 0) {
+      /* our socket is non-blocking, so there may be nothing to read. */
+      if (res < 0 && (errno == EAGAIN || errno == EWOULDBLOCK ||
+                      errno == EINTR))
+         return 0;
       return -1;
    }
+   c->input_len += res;
+   c->input[c->input_len] = 0;
 
-   /* add to our input buffer. */
-   al_connection_append_buffer (c, &(c->input), &(c->input_size),
-      &(c->input_len), &(c->input_pos), buf, res);
+   /* adjust our expectations. */
+   if ((size_t) res == room) {
+      c->flags |= AL_CONNECTION_READ_FILLED;
+      c->input_hint = AL_MIN (c->input_hint * 2, AL_CONNECTION_READ_MAX);
+   }
+   else {
+      c->flags &= ~AL_CONNECTION_READ_FILLED;
+      if ((size_t) res < c->input_hint / 4)
+         c->input_hint = AL_MAX (c->input_hint / 2, AL_CONNECTION_READ_MIN);
+   }
 
    /* return the number of bytes read. */
    return res;
 }
 
+/* al_connection_input_trim():
+ * ---------------------------
+ * Gives back the memory of an input buffer that's grown large once reads
+ * stop filling it.  If everything in it has been used, it's freed;
+ * otherwise, if what's left would fit in a quarter of it, it's shrunk.
+ * Buffers are kept while reads are still filling them, so bulk transfers
+ * don't free and allocate for every read.
+ *
+ * Return value: 1 if the buffer was freed or shrunk, otherwise 0.
+ */
+int al_connection_input_trim (al_connection_t *c)
+{
+   size_t unused, new_size;
+
+   if (c->input_size <= AL_CONNECTION_INPUT_KEEP ||
+       (c->flags & AL_CONNECTION_READ_FILLED))
+      return 0;
+   unused = c->input_len - c->input_pos;
+   if (unused > 0 && unused >= c->input_size / 4)
+      return 0;
+
+   al_connection_lock (c);
+   if (unused == 0) {
+      al_connection_input_resize (c, 0);
+      c->input_len = 0;
+      c->input_pos = 0;
+   }
+   else {
+      al_connection_input_compact (c);
+      for (new_size = c->input_size; new_size / 2 >= unused + 1 &&
+           new_size / 2 >= AL_CONNECTION_INPUT_KEEP; new_size /= 2);
+      al_connection_input_resize (c, new_size);
+   }
+   al_connection_unlock (c);
+   return 1;
+}
+
+/* al_connection_feed():
+ * ---------------------
+ * Feeds a connection's unused input to AL_SERVER_FUNC_READ until it stops
+ * consuming data.  The reactor does this after each read, and protocol
+ * modules that held back input they'd already been given can do it to
+ * pick up where they left off.  Must be called from the connection's own
+ * reactor, but not from its AL_SERVER_FUNC_READ.
+ *
+ * new_len: Number of bytes at the end of the input that weren't there the
+ *          last time it was fed.
+ *
+ * Return value: 1 on success.
+ */
+int al_connection_feed (al_connection_t *c, size_t new_len)
+{
+   al_server_t *server = c->server;
+
+   while (c->input_len > c->input_pos &&
+          server->func[AL_SERVER_FUNC_READ]) {
+      al_func_read_t data = {
+         .connection   = c,
+         .data         = c->input + c->input_pos,
+         .data_len     = c->input_len - c->input_pos,
+         .new_data     = c->input + c->input_len - new_len,
+         .new_data_len = new_len,
+         .bytes_used   = 0
+      };
+      server->func[AL_SERVER_FUNC_READ] (server, c,
+         AL_SERVER_FUNC_READ, &data);
+      if (data.bytes_used >= c->input_len - c->input_pos) {
+         c->input_len = 0;
+         c->input_pos = 0;
+      }
+      else if (data.bytes_used >= 1) {
+         c->input_pos += data.bytes_used;
+         new_len       = data.new_data_len;
+      }
+      else
+         break;
+   }
+
+   /* bulk transfers leave large buffers behind. */
+   al_connection_input_trim (c);
+   return 1;
+}
+
+/* al_connection_set_input_max():
+ * ------------------------------
+ * Sets the most input a connection holds on to before it's been used.
+ * Once it's reached, AL_SERVER_FUNC_INPUT_FULL decides whether the
+ * connection is closed.  New connections start with their server's limit
+ * (see al_server_set_input_max()).
+ *
+ * max: Number of bytes, or 0 for no limit.
+ */
+int al_connection_set_input_max (al_connection_t *c, size_t max)
+{
+   c->input_max = max;
+   return 1;
+}
+
+static ssize_t al_connection_writev (al_connection_t *c,
+   const struct iovec *iov, int count)
+{
+#ifdef MSG_NOSIGNAL
+   /* clients disappearing shouldn't raise SIGPIPE.  descriptors that aren't
+    * sockets can't be sent to, so remember that and use writev(). */
+   if (!(c->flags & AL_CONNECTION_NOT_SOCKET)) {
+      struct msghdr msg;
+      ssize_t res;
+
+      memset (&msg, 0, sizeof (msg));
+      msg.msg_iov    = (struct iovec *) iov;
+      msg.msg_iovlen = count;
+      if ((res = sendmsg (c->fd_out, &msg, MSG_NOSIGNAL)) >= 0 ||
+          errno != ENOTSOCK)
+         return res;
+      c->flags |= AL_CONNECTION_NOT_SOCKET;
+   }
+#endif
+   return writev (c->fd_out, iov, count);
+}
+
+static ssize_t al_connection_sendfile (al_connection_t *c,
+   const al_buffer_seg_t *s, size_t max)
+{
+   al_buffer_t *b = s->buffer;
+   off_t offset = b->offset + s->pos;
+   size_t len = AL_MIN (s->len - s->pos, max);
+
+#ifdef HAVE_SYS_SENDFILE_H
+   struct timespec zero = {0, 0};
+   sigset_t pipe_set, old_set, pending;
+   ssize_t res;
+   int err;
+
+   /* sendfile() has no MSG_NOSIGNAL.  block SIGPIPE while we're sending and
+    * quietly take it back if it was raised. */
+   sigemptyset (&pipe_set);
+   sigaddset (&pipe_set, SIGPIPE);
+   pthread_sigmask (SIG_BLOCK, &pipe_set, &old_set);
+   res = sendfile (c->fd_out, b->fd, &offset, len);
+   err = errno;
+   if (res < 0 && err == EPIPE) {
+      sigpending (&pending);
+      if (sigismember (&pending, SIGPIPE))
+         sigtimedwait (&pipe_set, NULL, &zero);
+   }
+   pthread_sigmask (SIG_SETMASK, &old_set, NULL);
+   errno = err;
+   return res;
+#else
+   /* no sendfile()?  read the file ourselves. */
+   unsigned char buf[16384];
+   struct iovec iov;
+   ssize_t res;
+
+   if ((res = pread (b->fd, buf, AL_MIN (len, sizeof (buf)), offset)) <= 0)
+      return res;
+   iov.iov_base = buf;
+   iov.iov_len  = res;
+   return al_connection_writev (c, &iov, 1);
+#endif
+}
+
 int al_connection_fd_write (al_connection_t *c)
 {
+   struct iovec iov[AL_CONNECTION_IOV_MAX];
+   ssize_t res;
+   int count;
+
    /* do nothing if there's no descriptor for writing. */
    if (c->fd_out < 0)
       return -1;
 
    /* output at most 'c->output_max' bytes.  bail if there's no work for us. */
-   size_t bytes = c->output_len - c->output_pos,
-          max   = c->output_max < bytes ? c->output_max : bytes;
+   size_t max = AL_MIN (c->output_max, c->output.len);
    if (max <= 0 || !(c->flags & AL_CONNECTION_WRITING))
       return 0;
 
-   /* attempt to write to the socket. */
-   int res;
-   if ((res = write (c->fd_out, c->output + c->output_pos, bytes)) <= 0) {
-      AL_ERROR ("Couldn't write %ld bytes to client [%d].\n", bytes,
+   /* files are sent on their own.  otherwise, gather as many segments as
+    * we can and write them all at once. */
+   if (c->output.first->buffer->flags & AL_BUFFER_FILE)
+      res = al_connection_sendfile (c, c->output.first, max);
+   else {
+      count = al_buffer_queue_iov (&(c->output), iov, AL_CONNECTION_IOV_MAX,
+         max);
+      res = al_connection_writev (c, iov, count);
+   }
+   if (res <= 0) {
+      /* our socket is non-blocking, so it may not be ready yet. */
+      if (res < 0 && (errno == EAGAIN || errno == EWOULDBLOCK ||
+                      errno == EINTR))
+         return 0;
+      AL_ERROR ("Couldn't write %ld bytes to client [%d].\n", (long) max,
                 c->fd_out);
       return -1;
    }
 
-   /* if we wrote everything, clear out our buffer. */
-   if (res >= bytes) {
-      c->output_len = 0;
-      c->output_pos = 0;
+   /* drop everything that was written.  if that's all of it, we're no
+    * longer waiting to write. */
+   al_buffer_queue_consume (&(c->output), res);
+   AL_ATOMIC_SUB (&(c->reactor->output_bytes), (size_t) res);
+   if (c->output.len == 0)
       c->flags &= ~AL_CONNECTION_WROTE;
-   }
-   /* otherwise, just move forward a little bit. */
-   else
-      c->output_pos += bytes;
 
    /* allow AL_SERVER_FUNC_PRE_WRITE to run again once output_max
     * reaches zero.  this way, if we've queued a massive amount of data for
@@ -268,21 +642,140 @@ int al_connection_fd_write (al_connection_t *c)
    if (c->output_max <= 0)
       c->flags &= ~AL_CONNECTION_WRITING;
 
-   return bytes;
+   return res;
 }
 
+/* writes from threads other than the one running the connection's reactor
+ * are handed to it through its post queue, which takes no locks.  before
+ * the loops start, everyone writes directly. */
+static int al_connection_remote (const al_connection_t *c)
+{
+   return al_reactor_current (c->server) != c->reactor &&
+          al_server_is_running (c->server);
+}
+
+/* writes are refused once a connection's output reaches its high
+ * watermark.  whoever was refused hears from AL_SERVER_FUNC_WRITABLE once
+ * it's drained, since we're still writing until then. */
+static int al_connection_output_full (al_connection_t *c)
+{
+   if (c->output_high == 0 || c->output.len < c->output_high)
+      return 0;
+   c->flags |= AL_CONNECTION_NOTIFY_WRITABLE;
+   return 1;
+}
+
+/* al_connection_write():
+ * al_connection_write_buffer():
+ * -----------------------------
+ * Queues data for output.  al_connection_write() queues a copy, while
+ * al_connection_write_buffer() shares the buffer without copying it.  The
+ * connection takes its own reference, so the caller should still drop
+ * theirs.  Writes made from other threads are handed to the connection's
+ * reactor, and are queued there whatever its watermarks.
+ *
+ * The connection may be freed by its reactor at any time, and its memory
+ * reused for another.  Other threads must either hold al_connection_lock()
+ * while they write, which keeps it from being freed until the write has
+ * been handed off (they must still know it hasn't been freed already, by
+ * forgetting it from AL_SERVER_FUNC_LEAVE, for example), or write by id with
+ * al_server_submit() and al_server_submit_buffer() instead.  The same goes for
+ * al_connection_write_string() and al_connection_write_queue().
+ *
+ * Return value: 1 on success, 0 if nothing was written, or
+ *               AL_CONNECTION_WOULD_BLOCK if the connection's output has
+ *               reached its high watermark (see
+ *               al_connection_set_output_watermarks()).  Nothing is queued
+ *               in that case, and AL_SERVER_FUNC_WRITABLE runs once there's
+ *               room again.
+ */
 int al_connection_write (al_connection_t *c, const unsigned char *buf,
    size_t size)
 {
+   int res;
+
    /* don't write blank data or to connections being closed. */
    if (size == 0 || c->flags & AL_CONNECTION_CLOSING)
       return 0;
-   int res = al_connection_append_buffer (c, &(c->output), &(c->output_size),
-      &(c->output_len), &(c->input_pos), buf, size);
+
+   /* connections owned by another thread are written by their own. */
+   if (al_connection_remote (c))
+      return al_reactor_post (c->reactor, c, AL_REACTOR_POST_WRITE, buf,
+         size);
+   if (al_connection_output_full (c))
+      return AL_CONNECTION_WOULD_BLOCK;
+
+   /* queue a copy of our data. */
+   al_connection_lock (c);
+   if ((res = al_buffer_queue_copy (&(c->output), buf, size)) == 1)
+      AL_ATOMIC_ADD (&(c->reactor->output_bytes), size);
+   al_connection_unlock (c);
    al_connection_wrote (c);
    return res;
 }
 
+int al_connection_write_buffer (al_connection_t *c, al_buffer_t *b)
+{
+   int res;
+
+   /* don't write blank data or to connections being closed. */
+   if (b->len == 0 || c->flags & AL_CONNECTION_CLOSING)
+      return 0;
+
+   /* connections owned by another thread are written by their own. */
+   if (al_connection_remote (c))
+      return al_reactor_post_buffer (c->reactor, c, AL_REACTOR_POST_WRITE, b);
+   if (al_connection_output_full (c))
+      return AL_CONNECTION_WOULD_BLOCK;
+
+   al_connection_lock (c);
+   if ((res = al_buffer_queue_append (&(c->output), b, 0, b->len)) == 1)
+      AL_ATOMIC_ADD (&(c->reactor->output_bytes), b->len);
+   al_connection_unlock (c);
+   al_connection_wrote (c);
+   return res;
+}
+
+/* al_connection_write_queue():
+ * ----------------------------
+ * Moves everything in 'q' to the back of the connection's output, leaving
+ * 'q' empty.  Nothing is copied, even when the connection belongs to
+ * another reactor, since segments are posted along with their buffers.
+ * The output's high watermark isn't checked, so protocol modules can finish
+ * what they've started and pace themselves with
+ * al_connection_notify_writable().  Other threads must follow the rules of
+ * al_connection_write().
+ *
+ * Return value: 1 on success, 0 if nothing was written.
+ */
+int al_connection_write_queue (al_connection_t *c, al_buffer_queue_t *q)
+{
+   al_buffer_seg_t *s;
+
+   /* don't write blank data or to connections being closed. */
+   if (q->len == 0 || c->flags & AL_CONNECTION_CLOSING) {
+      al_buffer_queue_clear (q);
+      return 0;
+   }
+
+   /* connections owned by another thread are written by their own.  each
+    * segment goes along with its part of its buffer, files included. */
+   if (al_connection_remote (c)) {
+      for (s = q->first; s != NULL; s = s->next)
+         al_reactor_post_splice (c->reactor, c, s->buffer, s->pos,
+            s->len - s->pos);
+      al_buffer_queue_clear (q);
+      return 1;
+   }
+
+   al_connection_lock (c);
+   AL_ATOMIC_ADD (&(c->reactor->output_bytes), q->len);
+   al_buffer_queue_splice (&(c->output), q);
+   al_connection_unlock (c);
+   al_connection_wrote (c);
+   return 1;
+}
+
 int al_connection_write_string (al_connection_t *c, const char *string)
 {
    /* send a string as unsigned bytes. */
@@ -294,7 +787,122 @@ int al_connection_wrote (al_connection_t *c)
 {
    /* mark that this connection is awaiting al_connection_stage_output(). */
    c->flags |= AL_CONNECTION_WROTE;
-   al_server_interrupt (c->server);
+   al_connection_pending (c);
+   al_reactor_interrupt (c->reactor);
+   return 1;
+}
+
+int al_connection_pending (al_connection_t *c)
+{
+   /* queue this connection for its reactor, which will stage its output,
+    * update its poller interest, and close it if necessary.  only
+    * connections in this list are visited between waits. */
+   al_connection_lock (c);
+   if (c->flags & AL_CONNECTION_PENDING) {
+      al_connection_unlock (c);
+      return 0;
+   }
+   c->flags |= AL_CONNECTION_PENDING;
+   AL_LL_LINK_FRONT_GLOBAL (c, pending_prev, pending_next,
+      c->reactor->pending_list);
+   al_connection_unlock (c);
+   return 1;
+}
+
+/* al_connection_notify_writable():
+ * --------------------------------
+ * Asks for AL_SERVER_FUNC_WRITABLE to run once a connection's output has
+ * drained to its low watermark (everything, by default).  Producers that
+ * ask again after each batch never queue more than they need to keep the
+ * connection busy.  Must be called from the connection's own reactor.
+ */
+int al_connection_notify_writable (al_connection_t *c)
+{
+   c->flags |= AL_CONNECTION_NOTIFY_WRITABLE;
+   al_connection_pending (c);
+   return 1;
+}
+
+/* al_connection_set_output_watermarks():
+ * --------------------------------------
+ * Sets a connection's output watermarks.  New connections start with their
+ * server's (see al_server_set_output_watermarks()).
+ *
+ * high: Bytes queued before writes are refused, or 0 for no limit.
+ * low:  Bytes queued once AL_SERVER_FUNC_WRITABLE runs, below 'high'.
+ *
+ * Return value: 1 on success, 0 if 'low' isn't below 'high'.
+ */
+int al_connection_set_output_watermarks (al_connection_t *c, size_t high,
+   size_t low)
+{
+   if (high > 0 && low >= high)
+      return 0;
+   c->output_high = high;
+   c->output_low  = low;
+   return 1;
+}
+
+/* is all of our server's output over its budget? */
+static int al_connection_over_budget (const al_server_t *server)
+{
+   size_t budget, bytes = 0;
+   int i;
+
+   if ((budget = AL_ATOMIC_LOAD (&(server->output_budget))) == 0)
+      return 0;
+   for (i = 0; i < server->reactor_count; i++)
+      bytes += AL_ATOMIC_LOAD (&(server->reactors[i]->output_bytes));
+   return bytes > budget;
+}
+
+/* al_connection_read_paused():
+ * ----------------------------
+ * Decides whether a connection stops reading.  While our server's output is
+ * over its budget, connections whose peers aren't keeping up (with output
+ * past their high watermark) stop reading until they're down to their low
+ * watermark.  Their peers can't make us queue anything else until then.
+ */
+static int al_connection_read_paused (al_connection_t *c)
+{
+   if (c->output.len <= c->output_low)
+      c->flags &= ~AL_CONNECTION_READ_PAUSED;
+   else if (!(c->flags & AL_CONNECTION_READ_PAUSED) &&
+            c->output.len >= c->output_high &&
+            al_connection_over_budget (c->server)) {
+      c->flags |= AL_CONNECTION_READ_PAUSED;
+      AL_ATOMIC_ADD (&(c->reactor->read_pauses), 1);
+   }
+   return (c->flags & AL_CONNECTION_READ_PAUSED) ? 1 : 0;
+}
+
+int al_connection_update_poll (al_connection_t *c)
+{
+   al_poll_t *p = c->reactor->poll;
+   al_flags_t events = 0;
+
+   /* read unless we're closing or paused, and write if there's staged
+    * output. */
+   if (p == NULL)
+      return 0;
+   if (c->fd_in >= 0 && !(c->flags & AL_CONNECTION_CLOSING) &&
+       !al_connection_read_paused (c))
+      events |= AL_POLL_IN;
+   if (c->fd_out >= 0 && (c->flags & AL_CONNECTION_WRITING))
+      events |= AL_POLL_OUT;
+
+   /* only bother the poller if something changed. */
+   if (events == c->poll_events)
+      return 0;
+   if (c->fd_in == c->fd_out)
+      al_poll_modify (p, c->fd_in, events, c);
+   else {
+      if ((events ^ c->poll_events) & AL_POLL_IN)
+         al_poll_modify (p, c->fd_in,  events & AL_POLL_IN,  c);
+      if ((events ^ c->poll_events) & AL_POLL_OUT)
+         al_poll_modify (p, c->fd_out, events & AL_POLL_OUT, c);
+   }
+   c->poll_events = events;
    return 1;
 }
 
@@ -311,8 +919,8 @@ int al_connection_stage_output (al_connection_t *c)
    /* call the 'pre_write' function if available. */
    if (c->server->func[AL_SERVER_FUNC_PRE_WRITE]) {
       al_func_pre_write_t data = {
-         .data     = c->output,
-         .data_len = c->output_len
+         .data     = c->output.first,
+         .data_len = c->output.len
       };
       c->server->func[AL_SERVER_FUNC_PRE_WRITE] (c->server, c,
          AL_SERVER_FUNC_PRE_WRITE, &data);
@@ -320,15 +928,15 @@ int al_connection_stage_output (al_connection_t *c)
 
    /* make that there's data to write out and record/return the byte count. */
    c->flags |= AL_CONNECTION_WRITING;
-   c->output_max = c->output_len - c->output_pos;
+   c->output_max = c->output.len;
    return c->output_max;
 }
 
 al_module_t *al_connection_module_new (al_connection_t *connection,
    const char *name, void *data, size_t data_size, al_module_func *free_func)
 {
-   return al_module_new (connection, &(connection->module_list), name, data,
-      data_size, free_func);
+   return al_module_new (connection, &(connection->module_list),
+      connection->module_slots, name, data, data_size, free_func);
 }
 al_module_t *al_connection_module_get (const al_connection_t *connection,
    const char *name)
@@ -336,34 +944,47 @@ al_module_t *al_connection_module_get (const al_connection_t *connection,
    return al_module_get (&(connection->module_list), name);
 }
 
+/* al_connection_module_slot():
+ * ----------------------------
+ * Looks up a module by the id registered for its name with
+ * al_module_register(), without searching.
+ *
+ * Return value: The module, or NULL if there isn't one.
+ */
+al_module_t *al_connection_module_slot (const al_connection_t *connection,
+   int id)
+{
+   return (id >= 0 && id < AL_MODULE_SLOTS) ? connection->module_slots[id]
+                                            : NULL;
+}
+
 int al_connection_set_timeout (al_connection_t *connection, float timeout)
 {
+   int res;
+
    /* are we cancelling the timeout? */
    if (timeout < 0.00f) {
-      /* is it already off? */
-      if (connection->timeout.tv_usec == 0 && connection->timeout.tv_sec == 0)
-         return 0;
-      /* it's not. turn it off. */
-      else {
-         connection->timeout.tv_sec  = 0;
-         connection->timeout.tv_usec = 0;
-         return 1;
-      }
+      al_connection_lock (connection);
+      res = al_timer_cancel (&(connection->timeout));
+      al_connection_unlock (connection);
+      return res;
    }
 
-   /* calculate the new time for timeout. */
-   struct timeval t, add, sum;
-   gettimeofday (&t, NULL);
-   add.tv_sec  = (time_t) timeout;
-   add.tv_usec = (suseconds_t) (1000000.00f * (timeout - (float) add.tv_sec));
-   timeradd (&t, &add, &sum);
-
-   /* is this sooner than before? if so, interrupt the server. */
-   if ((connection->timeout.tv_usec == 0 && connection->timeout.tv_sec == 0)
-       || timercmp (&sum, &(connection->timeout), <))
-      al_server_interrupt (connection->server);
+   /* (re)set our timer.  it runs al_connection_timeout_func() on expiry. */
+   return al_connection_timer_set (connection, &(connection->timeout),
+      (unsigned long) (timeout * 1000.00f));
+}
 
-   /* set the new timeout and return success. */
-   connection->timeout = sum;
+int al_connection_timer_set (al_connection_t *connection, al_timer_t *timer,
+   unsigned long ms)
+{
+   /* timers run in the thread of the reactor that owns the connection. */
+   al_connection_lock (connection);
+   al_timer_set (connection->reactor->timers, timer, ms);
+
+   /* if the reactor is waiting in another thread, make sure it knows. */
+   if (al_reactor_current (connection->server) != connection->reactor)
+      al_reactor_interrupt (connection->reactor);
+   al_connection_unlock (connection);
    return 1;
 }
@@ -0,0 +1,290 @@
+/* header.c
+ * --------
+ * indexed storage for HTTP header fields. */
+
+#include <ctype.h>
+#include <string.h>
+
+#include "alpaca/header.h"
+
+/* names with a slot of their own, in order of their ids. */
+static const struct {
+   const char *name;
+   size_t len;
+} al_http_header_names[AL_HEADER_ID_COUNT] = {
+   {NULL,                0},
+   {"Host",              4},
+   {"Connection",       10},
+   {"Content-Length",   14},
+   {"Content-Type",     12},
+   {"Transfer-Encoding",17},
+   {"Accept",            6},
+   {"Accept-Encoding",  15},
+   {"User-Agent",       10},
+   {"Cookie",            6},
+   {"Expect",            6},
+   {"Keep-Alive",       10},
+   {"Cache-Control",    13},
+   {"Date",              4},
+   {"Server",            6},
+   {"Location",          8},
+   {"Set-Cookie",       10},
+};
+
+static int al_http_header_name_eq (const char *a, const char *b, size_t len)
+{
+   size_t i;
+   for (i = 0; i < len; i++)
+      if (tolower ((unsigned char) a[i]) != tolower ((unsigned char) b[i]))
+         return 0;
+   return 1;
+}
+
+/* al_http_header_intern():
+ * ------------------------
+ * Looks up the id of a header name, ignoring case.
+ *
+ * hash: Set to the hash of the name in lowercase.
+ *
+ * Return value: The id of the name, or AL_HEADER_ID_NONE if it isn't one of
+ *               the names with a slot of their own.
+ */
+int al_http_header_intern (const char *name, size_t len, unsigned int *hash)
+{
+   unsigned int h;
+   size_t i;
+   int id;
+
+   /* FNV-1a. */
+   for (i = 0, h = 2166136261u; i < len; i++)
+      h = (h ^ (unsigned char) tolower ((unsigned char) name[i])) *
+          16777619u;
+   *hash = h;
+
+   for (id = 1; id < AL_HEADER_ID_COUNT; id++)
+      if (al_http_header_names[id].len == len &&
+          al_http_header_name_eq (al_http_header_names[id].name, name, len))
+         return id;
+   return AL_HEADER_ID_NONE;
+}
+
+const char *al_http_header_id_name (int id)
+{
+   if (id <= AL_HEADER_ID_NONE || id >= AL_HEADER_ID_COUNT)
+      return NULL;
+   return al_http_header_names[id].name;
+}
+
+int al_http_headers_init (al_http_headers_t *hs, int type)
+{
+   memset (hs, 0, sizeof (al_http_headers_t));
+   hs->type = type;
+   return 1;
+}
+
+static int al_http_header_same (const al_http_header_t *h, unsigned int hash,
+   const char *name, size_t len)
+{
+   return h->hash == hash && h->name_len == len &&
+          al_http_header_name_eq (h->name, name, len);
+}
+
+/* find the table slot holding a header with our name, or the empty slot it
+ * would go in. */
+static int al_http_headers_probe (const al_http_headers_t *hs,
+   unsigned int hash, const char *name, size_t len)
+{
+   int i;
+   for (i = hash & (AL_HTTP_HEADER_TABLE_SIZE - 1); hs->table[i] != NULL;
+        i = (i + 1) & (AL_HTTP_HEADER_TABLE_SIZE - 1))
+      if (al_http_header_same (hs->table[i], hash, name, len))
+         break;
+   return i;
+}
+
+/* al_http_headers_find():
+ * al_http_headers_find_id():
+ * --------------------------
+ * Return value: The first header with a name (ignoring case) or interned id,
+ *               or NULL if there's none.
+ */
+al_http_header_t *al_http_headers_find (const al_http_headers_t *hs,
+   const char *name)
+{
+   al_http_header_t *h;
+   unsigned int hash;
+   size_t len;
+   int id;
+
+   len = strlen (name);
+   if ((id = al_http_header_intern (name, len, &hash)) != AL_HEADER_ID_NONE)
+      return al_http_headers_find_id (hs, id);
+   if ((h = hs->table[al_http_headers_probe (hs, hash, name, len)]) != NULL)
+      return h;
+
+   /* it might be one we couldn't index. */
+   if (hs->unindexed > 0)
+      for (h = hs->first; h != NULL; h = h->next)
+         if (al_http_header_same (h, hash, name, len))
+            return h;
+   return NULL;
+}
+
+al_http_header_t *al_http_headers_find_id (const al_http_headers_t *hs,
+   int id)
+{
+   al_http_header_t *h;
+
+   if (id <= AL_HEADER_ID_NONE || id >= AL_HEADER_ID_COUNT)
+      return NULL;
+   if (hs->known[id] != NULL || hs->unindexed == 0)
+      return hs->known[id];
+   for (h = hs->first; h != NULL; h = h->next)
+      if (h->id == id)
+         return h;
+   return NULL;
+}
+
+/* index a header if nothing else has its name and there's room. */
+static int al_http_headers_index (al_http_headers_t *hs, al_http_header_t *h)
+{
+   int i;
+
+   if (h->id != AL_HEADER_ID_NONE) {
+      if (hs->known[h->id] != NULL)
+         return 0;
+      hs->known[h->id] = h;
+      return 1;
+   }
+   if (hs->table_count >= AL_HTTP_HEADER_TABLE_SIZE * 3 / 4)
+      return 0;
+   i = al_http_headers_probe (hs, h->hash, h->name, h->name_len);
+   if (hs->table[i] != NULL)
+      return 0;
+   hs->table[i] = h;
+   hs->table_count++;
+   return 1;
+}
+
+/* al_http_headers_link():
+ * -----------------------
+ * Adds a header to the back of a set.  'name' and 'value' must be set, along
+ * with their lengths; its id and hash are filled in here.
+ */
+int al_http_headers_link (al_http_headers_t *hs, al_http_header_t *h)
+{
+   h->type = hs->type;
+   h->id   = al_http_header_intern (h->name, h->name_len, &(h->hash));
+
+   h->next = NULL;
+   if ((h->prev = hs->last) != NULL)
+      hs->last->next = h;
+   else
+      hs->first = h;
+   hs->last = h;
+   hs->count++;
+
+   if (!al_http_headers_index (hs, h))
+      hs->unindexed++;
+   return 1;
+}
+
+/* take a header out of our table, shifting back anything that probed past
+ * its slot. */
+static int al_http_headers_table_remove (al_http_headers_t *hs,
+   const al_http_header_t *h)
+{
+   int mask = AL_HTTP_HEADER_TABLE_SIZE - 1, i, j, k;
+
+   for (i = h->hash & mask; hs->table[i] != h; i = (i + 1) & mask)
+      if (hs->table[i] == NULL)
+         return 0;
+   for (j = (i + 1) & mask; hs->table[j] != NULL; j = (j + 1) & mask) {
+      k = hs->table[j]->hash & mask;
+      if ((j > i && (k <= i || k > j)) || (j < i && k <= i && k > j)) {
+         hs->table[i] = hs->table[j];
+         i = j;
+      }
+   }
+   hs->table[i] = NULL;
+   hs->table_count--;
+   return 1;
+}
+
+/* al_http_headers_unlink():
+ * -------------------------
+ * Removes a header from a set.  If another header has the same name, it
+ * takes over the index.
+ */
+int al_http_headers_unlink (al_http_headers_t *hs, al_http_header_t *h)
+{
+   al_http_header_t *n;
+   int indexed;
+
+   if (h->prev)
+      h->prev->next = h->next;
+   else
+      hs->first = h->next;
+   if (h->next)
+      h->next->prev = h->prev;
+   else
+      hs->last = h->prev;
+   h->prev = h->next = NULL;
+   hs->count--;
+
+   /* drop it from our index. */
+   if (h->id != AL_HEADER_ID_NONE) {
+      if ((indexed = (hs->known[h->id] == h)))
+         hs->known[h->id] = NULL;
+   }
+   else
+      indexed = al_http_headers_table_remove (hs, h);
+   if (!indexed) {
+      hs->unindexed--;
+      return 1;
+   }
+
+   /* index the next header with this name, if there is one. */
+   for (n = hs->first; n != NULL && hs->unindexed > 0; n = n->next)
+      if (n->id == h->id && (h->id != AL_HEADER_ID_NONE ||
+          al_http_header_same (n, h->hash, h->name, h->name_len))) {
+         if (al_http_headers_index (hs, n))
+            hs->unindexed--;
+         break;
+      }
+   return 1;
+}
+
+/* al_http_headers_size():
+ * al_http_headers_serialize():
+ * ----------------------------
+ * Writes every header in a set as "Name: value\r\n" lines.  'out' must have
+ * room for al_http_headers_size() bytes.
+ *
+ * Return value: The end of what was written.
+ */
+size_t al_http_headers_size (const al_http_headers_t *hs)
+{
+   const al_http_header_t *h;
+   size_t size = 0;
+   for (h = hs->first; h != NULL; h = h->next)
+      size += h->name_len + h->value_len + 4;
+   return size;
+}
+
+unsigned char *al_http_headers_serialize (const al_http_headers_t *hs,
+   unsigned char *out)
+{
+   const al_http_header_t *h;
+   for (h = hs->first; h != NULL; h = h->next) {
+      memcpy (out, h->name, h->name_len);
+      out += h->name_len;
+      *out++ = ':';
+      *out++ = ' ';
+      memcpy (out, h->value, h->value_len);
+      out += h->value_len;
+      *out++ = '\r';
+      *out++ = '\n';
+   }
+   return out;
+}
@@ -2,22 +2,39 @@
  * ------
  * HTTP API development tools. */
 
+#include <sys/stat.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 #include <stdarg.h>
+#include <unistd.h>
 
+#include "alpaca/buffer.h"
 #include "alpaca/connections.h"
 #include "alpaca/modules.h"
+#include "alpaca/pool.h"
+#include "alpaca/reactor.h"
 #include "alpaca/read.h"
 #include "alpaca/server.h"
 #include "alpaca/uri.h"
+#include "alpaca/workers.h"
 
 #include "alpaca/http.h"
 
+/* the module slot for our server and session data. */
+static int al_http_module = -1;
+
 al_http_t *al_http_init (al_server_t *server)
 {
+   /* claim our module slot, so our data is found without searching. */
+   if (al_http_module < 0 &&
+       (al_http_module = al_module_register ("http")) < 0) {
+      AL_ERROR ("al_http_init(): No module slots left.\n");
+      return NULL;
+   }
+
    /* don't initialize if already initialized. */
-   if (al_server_module_get (server, "http")) {
+   if (al_server_module_slot (server, al_http_module)) {
       AL_ERROR ("al_http_init(): HTTP module already initialized.\n");
       return NULL;
    }
@@ -26,7 +43,10 @@ al_http_t *al_http_init (al_server_t *server)
     * the HTTP module. */
    al_http_t *http_data = calloc (1, sizeof (al_http_t));
    http_data->server  = server;
-   http_data->timeout = AL_HTTP_TIMEOUT;
+   http_data->timeout      = AL_HTTP_TIMEOUT;
+   http_data->pipeline_max = AL_HTTP_PIPELINE_MAX;
+   http_data->body_max     = AL_HTTP_BODY_MAX;
+   pthread_mutex_init (&(http_data->mutex), NULL);
 
    /* create our module and set our own server function hooks. */
    al_module_t *module = al_server_module_new (server, "http", http_data,
@@ -34,6 +54,8 @@ al_http_t *al_http_init (al_server_t *server)
    al_server_func_set (server, AL_SERVER_FUNC_READ,    al_http_func_read);
    al_server_func_set (server, AL_SERVER_FUNC_JOIN,    al_http_func_join);
    al_server_func_set (server, AL_SERVER_FUNC_LEAVE,   al_http_func_leave);
+   al_server_func_set (server, AL_SERVER_FUNC_WRITABLE,
+      al_http_func_writable);
 
    /* data we can set now that the module exists. */
    http_data->module = module;
@@ -45,68 +67,173 @@ al_http_t *al_http_init (al_server_t *server)
 AL_MODULE_FUNC (al_http_data_free)
 {
    al_http_t *http = arg;
+   al_http_route_t *r;
    while (http->func_list)
       al_http_free_func (http->func_list);
+   while ((r = http->route_list) != NULL) {
+      http->route_list = r->next;
+      al_http_route_free (r);
+   }
+   pthread_mutex_destroy (&(http->mutex));
    return 0;
 }
 
 int al_http_state_cleanup (al_http_state_t *state)
 {
-   if (state->verb)        {free (state->verb);       state->verb       =NULL;}
-   if (state->uri_str)     {free (state->uri_str);    state->uri_str    =NULL;}
-   if (state->version_str) {free (state->version_str);state->version_str=NULL;}
    if (state->uri)         {al_uri_free (state->uri); state->uri        =NULL;}
+   state->verb        = NULL;
+   state->uri_str     = NULL;
+   state->version_str = NULL;
+   state->field_count = 0;
+   state->param_count = 0;
    al_http_state_cleanup_output (state);
    al_http_header_clear (state);
+   al_arena_reset (&(state->arena));
    return 1;
 }
 
-AL_MODULE_FUNC (al_http_state_data_free)
+static void al_http_state_free (al_http_state_t *state)
 {
-   al_http_state_t *state = arg;
    al_http_state_cleanup (state);
+   al_buffer_queue_clear (&(state->response));
+   al_arena_clear (&(state->arena));
+   al_pool_free (state, sizeof (al_http_state_t));
+}
+
+AL_MODULE_FUNC (al_http_session_data_free)
+{
+   al_http_session_t *session = arg;
+   al_http_state_t *state;
+
+   al_http_state_free (session->current);
+
+   /* deferred requests that haven't been completed yet are left to
+    * al_http_complete(), which frees them once it sees they've lost their
+    * connection.  any completion already posted is dropped along with our
+    * connection. */
+   pthread_mutex_lock (&(session->http->mutex));
+   while ((state = session->queue_first) != NULL) {
+      session->queue_first = state->next;
+      if ((state->flags & AL_STATE_DEFERRED) && !state->completed) {
+         state->connection = NULL;
+         state->session    = NULL;
+         state->next       = NULL;
+      }
+      else
+         al_http_state_free (state);
+   }
+   pthread_mutex_unlock (&(session->http->mutex));
+   while ((state = session->free_list) != NULL) {
+      session->free_list = state->next;
+      al_http_state_free (state);
+   }
    return 0;
 }
 
 AL_SERVER_FUNC (al_http_func_read)
 {
-   al_http_state_t *state = al_http_get_state (connection);
-   char buf[256];
-   int result;
+   al_http_session_t *session = al_http_get_session (connection);
+   al_func_read_t *read = arg;
+   al_http_state_t *state;
+   char *line, *end;
+   int result = 1;
+
+   /* responses finished while we're reading go out together at the end.
+    * anything held back is being looked at again. */
+   session->flags |= AL_SESSION_READING;
+   session->flags &= ~AL_SESSION_HELD;
+
+   /* parse complete lines right where they are in our input buffer.  bytes
+    * aren't used until their request is finished, so everything we've
+    * parsed stays put until our handler has returned.  every complete
+    * request is dispatched before any responses are written, so they all
+    * leave together. */
+   while (!(connection->flags & AL_CONNECTION_CLOSING) &&
+          !(session->flags & AL_SESSION_CLOSE)) {
+      /* bodies come before anything else. */
+      if (session->body) {
+         if ((result = al_http_state_body (session->body, read)) == 1)
+            continue;
+         result = (result == 0);
+         break;
+      }
+
+      state = session->current;
+      state->head = (char *) read->data;
+
+      /* don't start on another request while too many are queued.  we'll
+       * come back for it once some have been sent. */
+      if (state->line_pos == 0 &&
+          session->queue_count >= session->http->pipeline_max) {
+         al_http_session_flush (session);
+         if (session->queue_count >= session->http->pipeline_max) {
+            session->flags |= AL_SESSION_HELD;
+            break;
+         }
+      }
+
+      /* pick up where we left off.  if there's no complete line yet, wait
+       * for more - but not forever. */
+      if ((end = memchr (state->head + state->parse_pos, '\n',
+                         read->data_len - state->parse_pos)) == NULL) {
+         state->parse_pos = read->data_len;
+         if (state->parse_pos > AL_HTTP_HEAD_MAX)
+            result = 0;
+         break;
+      }
+
+      /* terminate our line, dropping its '\r\n' or '\n'. */
+      line = state->head + state->line_pos;
+      *end = '\0';
+      if (end > line && end[-1] == '\r')
+         end[-1] = '\0';
+      state->line_pos = state->parse_pos = end + 1 - state->head;
 
-   /* read lines as long as the connection is alive. */
-   while (al_read_line (buf, sizeof (buf), arg) > 0) {
       switch (state->state) {
          case AL_STATE_METHOD:
-            result = al_http_state_method (state, buf);
+            result = al_http_state_method (state, line);
             break;
          case AL_STATE_HEADER:
-            result = al_http_state_header (state, buf);
+            result = al_http_state_header (state, line);
             break;
          default:
-            result = (buf[0] == '\0' ? 0 : 1);
+            result = 1;
       }
+      if (result != 1)
+         break;
 
-      /* if the result wasn't successful, force the connection closed. */
-      if (result != 1) {
-         /* TODO: more descriptive error in (probably) HTML format. */
-         al_connection_write_string (connection,
-            "Bad request.  Closing connection.\n");
-         al_connection_close (connection);
-         return -1;
+      /* once a request has been dispatched (or we're still waiting for one
+       * to start), we're done with everything before the next one. */
+      if (state != session->current || state->state == AL_STATE_METHOD) {
+         al_read_used (read, state->line_pos);
+         state->parse_pos = 0;
+         state->line_pos  = 0;
       }
    }
 
+   /* send out everything we've finished.  if we're still reading a body,
+    * give the client more time. */
+   session->flags &= ~AL_SESSION_READING;
+   al_http_session_flush (session);
+   if (session->body && !(connection->flags & AL_CONNECTION_CLOSING))
+      al_connection_set_timeout (connection, session->http->timeout);
+
+   /* if the result wasn't successful, force the connection closed. */
+   if (result != 1) {
+      /* TODO: more descriptive error in (probably) HTML format. */
+      al_connection_write_string (connection,
+         "Bad request.  Closing connection.\n");
+      al_connection_close (connection);
+      return -1;
+   }
+
    /* return non-error. */
    return 0;
 }
 
-int al_http_state_method (al_http_state_t *state, const char *line)
+int al_http_state_method (al_http_state_t *state, char *line)
 {
-   /* allocate a mutable version. */
-   size_t len = strlen (line);
-   char mline[len + 1];
-   memcpy (mline, line, len + 1);
+   char *verb, *uri_str, *version_str;
 
    /* skip initial spaces and do nothing for blank lines. */
    while (*line == ' ')
@@ -114,29 +241,18 @@ int al_http_state_method (al_http_state_t *state, const char *line)
    if (*line == '\0')
       return 1;
 
-   /* make sure there's at least a verb and a URI. */
-   char *verb = mline, *uri_str;
-   if ((uri_str = strchr (mline, ' ')) == NULL)
-      uri_str = "";
-   else {
-      while (*uri_str == ' ') {
-         *uri_str = '\0';
-         uri_str++;
-      }
-   }
-
-   /* is there an HTTP version string? */
-   char *version_str;
+   /* split our line into a verb, a URI, and an optional version. */
+   verb = line;
+   if ((uri_str = strchr (verb, ' ')) == NULL)
+      uri_str = verb + strlen (verb);
+   else
+      while (*uri_str == ' ')
+         *(uri_str++) = '\0';
    if ((version_str = strchr (uri_str, ' ')) == NULL)
-      version_str = "";
-   else {
-      while (*version_str == ' ') {
-         *version_str = '\0';
-         version_str++;
-      }
-      if (*version_str == '\0')
-         version_str = NULL;
-   }
+      version_str = uri_str + strlen (uri_str);
+   else
+      while (*version_str == ' ')
+         *(version_str++) = '\0';
 
    /* get the version based on the version string. fallback to HTTP/0.9. */
    int version;
@@ -149,14 +265,14 @@ int al_http_state_method (al_http_state_t *state, const char *line)
    else
       version = AL_HTTP_0_9;
 
-   /* remember strings and version info. */
-   al_util_replace_string (&(state->verb),        verb);
-   al_util_replace_string (&(state->uri_str),     uri_str);
-   al_util_replace_string (&(state->version_str), version_str);
-   state->version = version;
+   /* remember where our strings are and our version info. */
+   state->verb_pos    = verb        - state->head;
+   state->uri_pos     = uri_str     - state->head;
+   state->version_pos = version_str - state->head;
+   state->version     = version;
 
    /* build our URI.  if it didn't work, status code is "Bad Request". */
-   if ((state->uri = al_uri_new (uri_str)) == NULL)
+   if ((state->uri = al_uri_new_arena (&(state->arena), uri_str)) == NULL)
       al_http_set_status_code (state, 400);
 
    /* behavior is different now depending on version. */
@@ -181,37 +297,33 @@ int al_http_state_method (al_http_state_t *state, const char *line)
    return 1;
 }
 
-int al_http_state_header (al_http_state_t *state, const char *line)
+int al_http_state_header (al_http_state_t *state, char *line)
 {
+   char *colon, *value;
+
    /* if this is the last line, finish our request. */
    if (*line == '\0')
       return al_http_state_finish (state);
 
    /* make sure this is a proper header field.  if not, mark as a bad
     * request. */
-   char *colon;
    if ((colon = strchr (line, ':')) == NULL) {
       al_http_set_status_code (state, 200);
       return 1;
    }
 
-   /* it's valid! build our own modifiable string we can use to split
-    * into a name/value pair. */
-   size_t len      = strlen (line),
-          name_len = colon - line;
-   char mline[len + 1];
-   memcpy (mline, line, len + 1);
-   char *name = mline, *value = mline + name_len + 1;
-
-   /* replace the colon with '\0' so 'name' is terminated. */
-   name[name_len] = '\0';
-
-   /* skip spaces for 'value'. */
-   while (*value == ' ')
-      value++;
+   /* it's valid!  terminate the name and skip spaces for the value. */
+   *colon = '\0';
+   for (value = colon + 1; *value == ' '; value++);
 
-   /* add to header. */
-   al_http_header_request_set (state, name, value);
+   /* remember where it is.  there's only so much room. */
+   if (state->field_count == AL_HTTP_HEADERS_MAX) {
+      al_http_set_status_code (state, 400);
+      return 1;
+   }
+   state->field_name[state->field_count]  = line  - state->head;
+   state->field_value[state->field_count] = value - state->head;
+   state->field_count++;
 
    /* return success. */
    return 1;
@@ -223,18 +335,18 @@ AL_SERVER_FUNC (al_http_func_join)
    AL_PRINTF ("JOIN:    %s (%s) #%d\n", connection->hostname,
       connection->ip_address, connection->fd_in);
 
-   /* initialize a blank state for our HTTP request. */
-   al_http_state_t *state = calloc (1, sizeof (al_http_state_t));
-   state->connection = connection;
-   state->http = al_http_get (server);
-   al_http_state_reset (state);
+   /* initialize a session with a blank state for our first request. */
+   al_http_session_t *session = calloc (1, sizeof (al_http_session_t));
+   session->connection = connection;
+   session->http       = al_http_get (server);
+   session->current    = al_http_session_new_state (session);
 
    /* force the connection to timeout after a time. */
-   al_connection_set_timeout (connection, state->http->timeout);
+   al_connection_set_timeout (connection, session->http->timeout);
 
    /* assign the http data and return success. */
-   al_connection_module_new (connection, "http", state,
-      sizeof (al_http_state_t), al_http_state_data_free);
+   al_connection_module_new (connection, "http", session,
+      sizeof (al_http_session_t), al_http_session_data_free);
    return 1;
 }
 
@@ -245,9 +357,140 @@ int al_http_state_reset (al_http_state_t *state)
    state->version     = AL_HTTP_INVALID;
    state->flags       = 0;
    state->status_code = 200;
+   state->parse_pos   = 0;
+   state->line_pos    = 0;
+   state->body_len    = 0;
+   state->body_left   = 0;
+   state->body_func   = NULL;
+   state->body_arg    = NULL;
+   state->stream_func = NULL;
+   state->stream_arg  = NULL;
+   state->completed   = 0;
+   state->worker_func = NULL;
+   return 1;
+}
+
+/* al_http_session_new_state():
+ * ----------------------------
+ * Return value: A blank state for the session's next request, reusing a
+ *               finished one if possible.
+ */
+al_http_state_t *al_http_session_new_state (al_http_session_t *session)
+{
+   al_http_state_t *state;
+
+   if ((state = session->free_list) != NULL)
+      session->free_list = state->next;
+   else {
+      state = al_pool_calloc (sizeof (al_http_state_t));
+      state->connection = session->connection;
+      state->http       = session->http;
+      state->session    = session;
+      al_arena_init (&(state->arena), 0);
+   }
+   state->next = NULL;
+   al_http_state_reset (state);
+   return state;
+}
+
+/* queue our finished request and start parsing the next one. */
+static void al_http_session_push (al_http_session_t *session,
+   al_http_state_t *state)
+{
+   state->next = NULL;
+   if (session->queue_last)
+      session->queue_last->next = state;
+   else
+      session->queue_first = state;
+   session->queue_last = state;
+   session->queue_count++;
+   session->current = al_http_session_new_state (session);
+
+   /* nothing after a request that closes the connection is read. */
+   if (!(state->flags & AL_STATE_PERSIST))
+      session->flags |= AL_SESSION_CLOSE;
+}
+
+/* connections waiting on deferred requests don't time out. */
+static int al_http_session_timeout (al_http_session_t *session)
+{
+   return al_connection_set_timeout (session->connection,
+      (session->deferred > 0) ? -1.00f : session->http->timeout);
+}
+
+/* parse requests we held back because too many were queued. */
+static AL_REACTOR_FUNC (al_http_session_resume)
+{
+   if (connection->flags & AL_CONNECTION_CLOSING)
+      return 0;
+   al_connection_feed (connection, 0);
    return 1;
 }
 
+/* al_http_session_flush():
+ * ------------------------
+ * Writes the responses at the front of a session's queue that are done,
+ * stopping at the first one that isn't.  If that one is being streamed,
+ * whatever it has so far goes too.  Responses are handed to the connection
+ * together, so they can leave in a single write.
+ *
+ * Return value: The number of responses finished.
+ */
+int al_http_session_flush (al_http_session_t *session)
+{
+   al_connection_t *connection = session->connection;
+   al_buffer_queue_t output = {0};
+   al_http_state_t *state;
+   int count = 0, close = 0;
+
+   while ((state = session->queue_first) != NULL) {
+      al_buffer_queue_splice (&output, &(state->response));
+      if (!(state->flags & AL_STATE_DONE))
+         break;
+      if ((session->queue_first = state->next) == NULL)
+         session->queue_last = NULL;
+      session->queue_count--;
+      count++;
+
+      /* nothing goes out after a response that ends the connection. */
+      close = !(state->flags & AL_STATE_PERSIST);
+
+      /* keep the state around for another request. */
+      al_http_state_reset (state);
+      state->next = session->free_list;
+      session->free_list = state;
+      if (close)
+         break;
+   }
+   if (output.len == 0 && count == 0)
+      return 0;
+
+   al_connection_write_queue (connection, &output);
+
+   /* should this connection be closed or kept alive? */
+   if (close) {
+      al_connection_close (connection);
+      return count;
+   }
+   al_http_session_timeout (session);
+
+   /* requests we held back can be parsed now.  their bytes are already in
+    * our input, so there may be nothing left to read. */
+   if ((session->flags & AL_SESSION_HELD) && count > 0 &&
+       !(session->flags & AL_SESSION_READING) &&
+       session->queue_count < session->http->pipeline_max) {
+      session->flags &= ~AL_SESSION_HELD;
+      al_reactor_post_func (connection->reactor, connection,
+         al_http_session_resume, NULL);
+   }
+
+   /* streams at the front want to hear when they can send more. */
+   if ((state = session->queue_first) != NULL &&
+       (state->flags & AL_STATE_STREAM) && state->stream_func)
+      al_connection_notify_writable (connection);
+   return count;
+}
+
 AL_SERVER_FUNC (al_http_func_leave)
 {
    /* log everything. */
@@ -257,10 +500,28 @@ AL_SERVER_FUNC (al_http_func_leave)
    return 0;
 }
 
+AL_SERVER_FUNC (al_http_func_writable)
+{
+   al_http_session_t *session = al_http_get_session (connection);
+   al_http_state_t *state = session->queue_first;
+
+   /* ask the response we're streaming for more.  it might finish (and be
+    * recycled) along the way. */
+   if (state == NULL || !(state->flags & AL_STATE_STREAM) ||
+       (state->flags & AL_STATE_DONE) || state->stream_func == NULL)
+      return 0;
+   state->stream_func (state, state->stream_arg);
+   if (session->queue_first == state && !(state->flags & AL_STATE_DONE))
+      al_http_stream_flush (state);
+   return 0;
+}
+
 al_http_t *al_http_get (const al_server_t *server)
-   { return al_server_module_get (server, "http")->data; }
+   { return server->module_slots[al_http_module]->data; }
 al_http_state_t *al_http_get_state (const al_connection_t *connection)
-   { return al_connection_module_get (connection, "http")->data; }
+   { return al_http_get_session (connection)->current; }
+al_http_session_t *al_http_get_session (const al_connection_t *connection)
+   { return connection->module_slots[al_http_module]->data; }
 
 al_http_func_def_t *al_http_set_func (al_http_t *http, const char *verb,
    al_http_func *func)
@@ -308,102 +569,785 @@ int al_http_free_func (al_http_func_def_t *fd)
    return 1;
 }
 
+/* al_http_func_set_worker():
+ * --------------------------
+ * Runs a function on the server's worker threads (see
+ * al_server_set_workers()) instead of its connection's reactor, so slow
+ * functions don't hold up other connections.  Requests are deferred (see
+ * al_http_defer()) before they're handed over, and completed once the
+ * function returns unless it returns AL_HTTP_PENDING.  Requests from the
+ * same connection are run one at a time, in order.  If the worker queue is
+ * full, the request is answered with 503 (Service Unavailable).
+ *
+ * Functions run this way mustn't use their connection or stream their
+ * response.  Requests with a body still run on the reactor, since their
+ * function has to be ready for the body as soon as it arrives.  Without a
+ * worker pool, functions always run on the reactor.
+ *
+ * Return value: 1 on success.
+ */
+int al_http_func_set_worker (al_http_func_def_t *fd, int worker)
+{
+   if (worker)
+      fd->flags |= AL_HTTP_FUNC_WORKER;
+   else
+      fd->flags &= ~AL_HTTP_FUNC_WORKER;
+   return 1;
+}
+
+/* parses a Content-Length value, rejecting anything but digits. */
+static int al_http_parse_length (const char *value, size_t *length)
+{
+   size_t len = 0;
+   if (*value == '\0')
+      return 0;
+   for (; *value != '\0'; value++) {
+      if (*value < '0' || *value > '9' || len > ((size_t) -1 - 9) / 10)
+         return 0;
+      len = len * 10 + (*value - '0');
+   }
+   *length = len;
+   return 1;
+}
+
+/* work out how our body is sent, if there is one.  bodies we can't read
+ * end the connection once our response is written. */
+static void al_http_state_body_check (al_http_state_t *state)
+{
+   al_http_header_t *te, *cl, *expect;
+   size_t len = 0;
+
+   state->state     = AL_STATE_METHOD;
+   state->body_len  = 0;
+   state->body_left = 0;
+   if (state->version == AL_HTTP_0_9)
+      return;
+
+   te     = al_http_header_request_get_id (state, AL_HEADER_ID_TRANSFER_ENCODING);
+   cl     = al_http_header_request_get_id (state, AL_HEADER_ID_CONTENT_LENGTH);
+   expect = al_http_header_request_get_id (state, AL_HEADER_ID_EXPECT);
+
+   /* chunked bodies are the only encoding we understand.  it has to come
+    * last, and it takes precedence over any length. */
+   if (te != NULL) {
+      if (te->value_len < 7 ||
+          strcasecmp (te->value + te->value_len - 7, "chunked") != 0) {
+         al_http_set_status_code (state, 501);
+         state->flags &= ~AL_STATE_PERSIST;
+         return;
+      }
+      state->state = AL_STATE_CHUNK_SIZE;
+   }
+   else if (cl != NULL) {
+      if (!al_http_parse_length (cl->value, &len)) {
+         al_http_set_status_code (state, 400);
+         state->flags &= ~AL_STATE_PERSIST;
+         return;
+      }
+      if (len > state->http->body_max) {
+         al_http_set_status_code (state, 413);
+         state->flags &= ~AL_STATE_PERSIST;
+         return;
+      }
+      if (len == 0)
+         return;
+      state->state     = AL_STATE_BODY;
+      state->body_left = len;
+   }
+   else
+      return;
+
+   /* clients waiting for permission to send a body they'd be refused
+    * don't get to send it at all. */
+   if (expect != NULL && state->status_code != 200) {
+      state->state = AL_STATE_METHOD;
+      state->flags &= ~AL_STATE_PERSIST;
+   }
+}
+
+/* start reading our body after our function has run. */
+static void al_http_state_body_start (al_http_state_t *state)
+{
+   al_http_session_t *session = state->session;
+   al_http_header_t *expect;
+
+   /* our head will be used up before our body arrives.  deferred and
+    * streamed requests have already been detached, and deferred ones might
+    * be in use elsewhere. */
+   if (!(state->flags & (AL_STATE_DEFERRED | AL_STATE_STREAM)))
+      al_http_state_detach (state);
+   session->body = state;
+
+   /* answer 'Expect: 100-continue' if nothing's ahead of us.  otherwise,
+    * the client will send its body eventually anyway. */
+   expect = al_http_header_request_get_id (state, AL_HEADER_ID_EXPECT);
+   if (expect != NULL && state->version == AL_HTTP_1_1 &&
+       strcasecmp (expect->value, "100-continue") == 0) {
+      al_http_session_flush (session);
+      if (session->queue_first == state)
+         al_connection_write_string (state->connection,
+            "HTTP/1.1 100 Continue\r\n\r\n");
+   }
+}
+
+/* al_http_state_detach():
+ * -----------------------
+ * Copies everything a finished request borrows from the input buffer into
+ * its arena, so it stays valid after the input has been used.
+ */
+int al_http_state_detach (al_http_state_t *state)
+{
+   al_arena_t *arena = &(state->arena);
+   al_http_header_t *h;
+
+   if (state->verb)
+      state->verb = al_arena_strdup (arena, state->verb);
+   if (state->uri_str)
+      state->uri_str = al_arena_strdup (arena, state->uri_str);
+   if (state->version_str)
+      state->version_str = al_arena_strdup (arena, state->version_str);
+   for (h = state->header_request.first; h != NULL; h = h->next) {
+      h->name  = al_arena_strndup (arena, h->name, h->name_len);
+      h->value = al_arena_strndup (arena, h->value, h->value_len);
+   }
+   return 1;
+}
+
+/* pass part of our body along, unless nobody wants it. */
+static void al_http_state_body_data (al_http_state_t *state,
+   const unsigned char *data, size_t len)
+{
+   state->body_len += len;
+   if (state->body_func &&
+       !state->body_func (state, data, len, state->body_arg))
+      state->body_func = NULL;
+}
+
+/* our body is done (or abandoned).  let our function know and finish our
+ * response. */
+static int al_http_state_body_end (al_http_state_t *state)
+{
+   state->session->body = NULL;
+   state->state = AL_STATE_METHOD;
+   if (state->body_func)
+      state->body_func (state, NULL, 0, state->body_arg);
+   state->body_func = NULL;
+
+   /* deferred requests are finished by al_http_complete().  until then,
+    * our connection waits. */
+   if (state->flags & AL_STATE_DEFERRED)
+      al_http_session_timeout (state->session);
+   else
+      al_http_write_finish (state);
+   return 1;
+}
+
+/* al_http_state_body():
+ * ---------------------
+ * Reads as much of a request body as there is in 'read', passing it to the
+ * request's body function without buffering it.  Chunked bodies are decoded
+ * on the way.
+ *
+ * Return value: 1 if we made progress, 0 if we need more data, or -1 if the
+ *               body is malformed.
+ */
+int al_http_state_body (al_http_state_t *state, al_func_read_t *read)
+{
+   char *line, *end;
+   size_t len;
+
+   /* raw data, up to the end of the body or chunk. */
+   if (state->state == AL_STATE_BODY || state->state == AL_STATE_CHUNK_DATA) {
+      if (read->data_len == 0)
+         return 0;
+      len = AL_MIN (read->data_len, state->body_left);
+      al_http_state_body_data (state, read->data, len);
+      al_read_used (read, len);
+      if ((state->body_left -= len) > 0)
+         return 1;
+      if (state->state == AL_STATE_BODY)
+         return al_http_state_body_end (state);
+      state->state = AL_STATE_CHUNK_END;
+      return 1;
+   }
+
+   /* everything else in a chunked body is a line. */
+   if ((end = memchr (read->data, '\n', read->data_len)) == NULL)
+      return (read->data_len > AL_HTTP_CHUNK_LINE_MAX) ? -1 : 0;
+   line = (char *) read->data;
+   *end = '\0';
+   if (end > line && end[-1] == '\r')
+      end[-1] = '\0';
+   al_read_used (read, end + 1 - line);
+
+   switch (state->state) {
+      /* chunk sizes are in hex, maybe followed by extensions we ignore. */
+      case AL_STATE_CHUNK_SIZE: {
+         char *p;
+         int digit;
+
+         for (p = line, len = 0; *p != '\0' && *p != ';' && *p != ' ' &&
+              *p != '\t'; p++) {
+            if      (*p >= '0' && *p <= '9') digit = *p - '0';
+            else if (*p >= 'a' && *p <= 'f') digit = *p - 'a' + 10;
+            else if (*p >= 'A' && *p <= 'F') digit = *p - 'A' + 10;
+            else
+               return -1;
+            if (len > (state->http->body_max >> 4))
+               len = state->http->body_max + 1;
+            else
+               len = (len << 4) | digit;
+         }
+         if (p == line)
+            return -1;
+
+         /* a chunk of zero ends the body, leaving only trailers. */
+         if (len == 0) {
+            state->state = AL_STATE_TRAILER;
+            return 1;
+         }
+
+         /* don't read more than we're allowed.  our response changes to
+          * say so, and the connection ends with it. */
+         if (len > state->http->body_max - state->body_len) {
+            al_http_state_cleanup_output (state);
+            al_http_set_status_code (state, 413);
+            state->flags &= ~AL_STATE_PERSIST;
+            state->session->flags |= AL_SESSION_CLOSE;
+            return al_http_state_body_end (state);
+         }
+         state->body_left = len;
+         state->state     = AL_STATE_CHUNK_DATA;
+         return 1;
+      }
+
+      /* chunks end with a blank line. */
+      case AL_STATE_CHUNK_END:
+         if (*line != '\0')
+            return -1;
+         state->state = AL_STATE_CHUNK_SIZE;
+         return 1;
+
+      /* trailers are ignored until the blank line at the end. */
+      case AL_STATE_TRAILER:
+         if (*line == '\0')
+            return al_http_state_body_end (state);
+         return 1;
+   }
+   return -1;
+}
+
+/* al_http_set_body_func():
+ * ------------------------
+ * Called from an HTTP function to receive the request's body as it
+ * arrives, rather than buffering it.  Functions run as soon as the head of
+ * a request has been read; the response is sent once the body is done.
+ * 'func' is called with each part of the body, then once more with a NULL
+ * 'data' at the end.  If the body was too large, the request's status code
+ * will be 413 by then.  Returning 0 from 'func' discards the rest of the
+ * body.  Bodies without a function are read and discarded.
+ *
+ * Function hook type definition (al_http_body_func):
+ * --------------------------------------------------
+ * AL_HTTP_BODY_FUNC (foo)  <-- parameters are (request, data, size, arg)
+ */
+int al_http_set_body_func (al_http_state_t *state, al_http_body_func *func,
+   void *arg)
+{
+   state->body_func = func;
+   state->body_arg  = arg;
+   return 1;
+}
+
+/* run an HTTP function away from our reactor, then finish its response
+ * unless it's going to do that itself. */
+static AL_WORKER_FUNC (al_http_worker_func)
+{
+   al_http_state_t *state = arg;
+   al_http_func_def_t *fd = state->worker_func;
+
+   if (fd->func (state, fd, NULL, state->uri ? state->uri->path : NULL) !=
+       AL_HTTP_PENDING)
+      al_http_complete (state);
+   return 1;
+}
+
 int al_http_state_finish (al_http_state_t *state)
 {
+   al_workers_t *workers = state->http->server->workers;
+   al_http_header_t *h;
+   int i;
+
+   /* our request is complete and won't move any more.  point to everything
+    * we parsed. */
+   state->verb        = state->head + state->verb_pos;
+   state->uri_str     = state->head + state->uri_pos;
+   state->version_str = state->head + state->version_pos;
+   for (i = 0; i < state->field_count; i++) {
+      h = al_arena_calloc (&(state->arena), sizeof (al_http_header_t));
+      h->state     = state;
+      h->name      = state->head + state->field_name[i];
+      h->value     = state->head + state->field_value[i];
+      h->name_len  = strlen (h->name);
+      h->value_len = strlen (h->value);
+      al_http_headers_link (&(state->header_request), h);
+   }
+
    /* HTTP/1.1 requires a 'Host' field.  if it's not there, 
     * set the status code to 'bad request'. */
    if (state->status_code == 200 && state->version == AL_HTTP_1_1) {
       /* TODO: do we need to DO anything with the host...? */
-      if (!al_http_header_request_get (state, "Host"))
+      if (!al_http_header_request_get_id (state, AL_HEADER_ID_HOST))
          al_http_set_status_code (state, 400);
    }
 
-   /* if the request is still good, attempt to get our function.  if it
+   /* clients that won't send any more requests get nothing after this
+    * response. */
+   if ((h = al_http_header_request_get_id (state, AL_HEADER_ID_CONNECTION))
+       != NULL && strcasecmp (h->value, "close") == 0)
+      state->flags &= ~AL_STATE_PERSIST;
+
+   /* see if there's a body coming. */
+   al_http_state_body_check (state);
+
+   /* if the request is still good, attempt to get our function, checking
+    * routes for our path before functions for the whole verb.  if it
     * doesn't exist, this becomes a bad request.  make sure we can't expliticly
     * request an error while we're at it. */
    al_http_func_def_t *fd = NULL;
-   if (state->status_code == 200)
-      if ((fd = al_http_get_func (state->http, state->verb)) == NULL ||
-          strcmp (state->verb, "ERROR") == 0)
+   if (state->status_code == 200) {
+      if ((fd = al_http_route_match (state->http, state, state->verb,
+                                     state->uri->str_path)) == NULL)
+         fd = al_http_get_func (state->http, state->verb);
+      if (fd == NULL || strcmp (state->verb, "ERROR") == 0)
          al_http_set_status_code (state, 400);
+   }
 
    /* if we don't have a function, this is a bad request.  we'll run a function
     * hook with verb 'ERROR' if it exists. */
    if (fd == NULL)
       fd = al_http_get_func (state->http, "ERROR");
 
-   /* run our function, if it exists. */
-   if (fd)
-      fd->func (state, fd, NULL, state->uri ? state->uri->path : NULL);
-
-   /* write everything out, including the header. */
-   al_http_write_finish (state);
-
-   /* should this connection be closed or kept alive? */
-   if (state->flags & AL_STATE_PERSIST) {
-      al_http_state_reset (state);
-      al_connection_set_timeout (state->connection, state->http->timeout);
+   /* queue our request behind any others that haven't been written yet,
+    * then run our function, if it exists. */
+   al_http_session_push (state->session, state);
+   if (fd && workers && (fd->flags & AL_HTTP_FUNC_WORKER) &&
+       state->state == AL_STATE_METHOD) {
+      al_http_defer (state);
+      state->worker_func = fd;
+      if (!al_workers_submit (workers, state->session, al_http_worker_func,
+                              state)) {
+         al_http_set_status_code (state, 503);
+         al_http_complete (state);
+      }
    }
-   else
-      al_connection_close (state->connection);
+   else if (fd && fd->func (state, fd, NULL,
+                            state->uri ? state->uri->path : NULL) ==
+            AL_HTTP_PENDING)
+      al_http_defer (state);
+
+   /* if there's a body, our response is finished once it's been read. */
+   if (state->state != AL_STATE_METHOD) {
+      al_http_state_body_start (state);
+      return 1;
+   }
+   if (state->flags & AL_STATE_DEFERRED)
+      return 1;
+
+   /* build our response, including the header.  it's written once the
+    * responses before it are.  streams finish on their own. */
+   if (!(state->flags & AL_STATE_STREAM))
+      al_http_write_finish (state);
 
    /* return success. */
    return 1;
 }
 
-int al_http_write_finish (al_http_state_t *state)
+/* copy bytes and move past them.  empty parts may not have any data at
+ * all, so they're skipped. */
+#define AL_HTTP_PUT(out, data, len) \
+   do { \
+      if ((len) > 0) { \
+         memcpy ((out), (data), (len)); \
+         (out) += (len); \
+      } \
+   } while (0)
+
+/* writes a number without snprintf(), returning its length. */
+static size_t al_http_format_number (char *out, size_t value, int base)
 {
-   /* lock server while writing to the connection. */
-   al_server_lock (state->connection->server);
+   char digits[24];
+   size_t len = 0, i;
+   do {
+      digits[len++] = "0123456789abcdef"[value % base];
+      value /= base;
+   } while (value > 0);
+   for (i = 0; i < len; i++)
+      out[i] = digits[len - i - 1];
+   return len;
+}
 
-   /* build a header based on content we built. */
-   if (state->version == AL_HTTP_1_0 || state->version == AL_HTTP_1_1) {
-      char header[8192];
-      size_t len;
+/* build the head of our response: the status line, how our body is
+ * delimited, custom header data and a blank line, copied straight into a
+ * buffer of the right size.  'pack' bytes of our body come along too. */
+static al_buffer_t *al_http_state_head (al_http_state_t *state, size_t pack)
+{
+   const char *status = al_http_status_code_string (state->status_code);
+   char code[24], length[24];
+   size_t code_len, length_len = 0, version_len, status_len, delim_len;
+   const char *delim;
+   unsigned char *out;
+   al_buffer_t *b;
+
+   /* streams are chunked if we can, otherwise they end with the
+    * connection. */
+   if (state->flags & AL_STATE_CHUNKED)
+      delim = "Transfer-Encoding: chunked\r\n";
+   else if (state->flags & AL_STATE_STREAM)
+      delim = "";
+   else {
+      delim = "Content-Length: ";
+      length_len = al_http_format_number (length,
+         state->output_len + (state->file ? state->file->len : 0), 10);
+      length[length_len++] = '\r';
+      length[length_len++] = '\n';
+   }
+
+   version_len = strlen (state->version_str);
+   status_len  = strlen (status);
+   delim_len   = strlen (delim);
+   code_len    = al_http_format_number (code, state->status_code, 10);
+   b = al_buffer_new (version_len + code_len + status_len + 4 + delim_len +
+      length_len + al_http_headers_size (&(state->header_response)) + 2 +
+      pack);
+
+   out = b->data;
+   AL_HTTP_PUT (out, state->version_str, version_len);
+   *out++ = ' ';
+   AL_HTTP_PUT (out, code, code_len);
+   *out++ = ' ';
+   AL_HTTP_PUT (out, status, status_len);
+   AL_HTTP_PUT (out, "\r\n", 2);
+   AL_HTTP_PUT (out, delim, delim_len);
+   AL_HTTP_PUT (out, length, length_len);
+   out = al_http_headers_serialize (&(state->header_response), out);
+   AL_HTTP_PUT (out, "\r\n", 2);
+   AL_HTTP_PUT (out, state->output, pack);
+   b->len = out - b->data;
+   return b;
+}
 
-      /* write our status code and content length. */
-      len = snprintf (header, sizeof (header),
-         "%s %d %s\r\n"
-         "Content-Length: %ld\r\n",
-         state->version_str, state->status_code,
-         al_http_status_code_string (state->status_code),
-         state->output_len);
+int al_http_write_finish (al_http_state_t *state)
+{
+   al_buffer_t *b;
+   size_t body;
 
-      /* write custom header data. */
-      al_http_header_t *h;
-      for (h = state->header_response; h != NULL; h = h->next)
-         len += snprintf (header + len, sizeof (header) - len, "%s: %s\r\n",
-            h->name, h->value);
+   /* streams have already sent their head. */
+   if (state->flags & AL_STATE_STREAM)
+      return al_http_stream_end (state);
 
-      /* end our header and send it out. */
-      len += snprintf (header + len, sizeof (header) - len, "\r\n");
-      al_connection_write_string (state->connection, header);
+   /* if the status code is 204 (No Content), write no body. */
+   body = (state->output && state->status_code != 204) ? state->output_len : 0;
+
+   /* build a header based on content we built.  small bodies come along
+    * with it. */
+   if (state->version == AL_HTTP_1_0 || state->version == AL_HTTP_1_1) {
+      b = al_http_state_head (state, body <= AL_HTTP_PACK_MAX ? body : 0);
+      if (body <= AL_HTTP_PACK_MAX)
+         body = 0;
+      al_buffer_queue_append (&(state->response), b, 0, b->len);
+      al_buffer_unref (b);
    }
 
    /* TODO: eventually, there might be gzip compression or other
-    * considerations. */
-   if (state->output) {
-      /* if the status code is 204 (No Content), write nothing more. */
-      if (state->status_code != 204)
-         al_connection_write (state->connection, state->output,
-            state->output_len);
-      al_http_state_cleanup_output (state);
+    * considerations.  larger bodies are handed over rather than copied. */
+   if (body > 0) {
+      b = al_buffer_take (state->output, state->output_len,
+         state->output_size);
+      state->output = NULL;
+      al_buffer_queue_append (&(state->response), b, 0, b->len);
+      al_buffer_unref (b);
    }
 
+   /* files are sent straight from the kernel after everything else. */
+   if (state->file && state->status_code != 204)
+      al_buffer_queue_append (&(state->response), state->file, 0,
+         state->file->len);
+   al_http_state_cleanup_output (state);
+
    /* log our result. */
    AL_PRINTF ("   #%d: [%s] [%s] [%s]\n", state->connection->fd_in,
       state->verb, state->uri_str, state->version_str);
 
-   /* return success. */
-   al_server_unlock (state->connection->server);
+   /* our response is ready to go once the ones before it are. */
+   state->flags |= AL_STATE_DONE;
+   return 1;
+}
+
+/* finish a deferred request from its connection's reactor. */
+static AL_REACTOR_FUNC (al_http_complete_func)
+{
+   al_http_state_t *state = arg;
+   al_http_session_t *session = state->session;
+
+   state->flags &= ~AL_STATE_DEFERRED;
+   session->deferred--;
+
+   /* if our body is still coming, we're finished once it's been read. */
+   if (session->body != state)
+      al_http_write_finish (state);
+   al_http_session_flush (session);
+   if (!(connection->flags & AL_CONNECTION_CLOSING))
+      al_http_session_timeout (session);
+   return 1;
+}
+
+/* al_http_defer():
+ * -----------------
+ * Called from an HTTP function to finish its response later with
+ * al_http_complete(), rather than once the function returns.  Returning
+ * AL_HTTP_PENDING from the function does the same, but requests must be
+ * deferred before they're handed to another thread.  Everything the request
+ * borrowed from the input buffer is copied, and its connection won't time
+ * out until it's completed.  Streamed responses can't be deferred.
+ *
+ * Return value: 1 on success, 0 if the request was already deferred or its
+ *               response was started.
+ */
+int al_http_defer (al_http_state_t *state)
+{
+   if (state->flags & (AL_STATE_DEFERRED | AL_STATE_STREAM | AL_STATE_DONE))
+      return 0;
+   state->flags |= AL_STATE_DEFERRED;
+   state->session->deferred++;
+   al_http_state_detach (state);
+   al_http_session_timeout (state->session);
+   return 1;
+}
+
+/* al_http_complete():
+ * -------------------
+ * Finishes the response of a deferred request.  Until then, the request
+ * belongs to whoever is building its response, which may be done from any
+ * thread with al_http_write() and friends; it's sent once the responses
+ * before it have been.  Its body, if it has one, is still passed to its body
+ * function from the connection's reactor.  This may be called from any
+ * thread, but before the server is freed, and wakes up the reactor to send
+ * our response.  The request must not be used afterwards.
+ *
+ * Return value: 1 if our response will be sent, or 0 if the client has
+ *               gone away (in which case the request is freed here) or the
+ *               request was already completed.
+ */
+int al_http_complete (al_http_state_t *state)
+{
+   pthread_mutex_t *mutex = &(state->http->mutex);
+   al_connection_t *c;
+
+   pthread_mutex_lock (mutex);
+   if ((c = state->connection) == NULL) {
+      pthread_mutex_unlock (mutex);
+      al_http_state_free (state);
+      return 0;
+   }
+   if (state->completed) {
+      pthread_mutex_unlock (mutex);
+      return 0;
+   }
+   state->completed = 1;
+   al_reactor_post_func (c->reactor, c, al_http_complete_func, state);
+   pthread_mutex_unlock (mutex);
+   return 1;
+}
+
+/* al_http_stream_start():
+ * -----------------------
+ * Sends the head of a response right away, without waiting for its body.
+ * Everything written afterwards goes out with each al_http_stream_flush(),
+ * as a chunk for HTTP/1.1 clients.  HTTP/1.0 clients get the body as-is,
+ * ended by closing the connection.  The response ends with
+ * al_http_stream_end(), which may be called after the HTTP function has
+ * returned, but only from the connection's own reactor.  Everything the
+ * request borrowed from the input buffer is copied, so it can still be used
+ * until then.
+ *
+ * Return value: 1 on success, 0 if the response was deferred, already
+ *               started, or finished.
+ */
+int al_http_stream_start (al_http_state_t *state)
+{
+   al_buffer_t *b;
+
+   if (state->flags & (AL_STATE_STREAM | AL_STATE_DONE | AL_STATE_DEFERRED))
+      return 0;
+   state->flags |= AL_STATE_STREAM;
+
+   /* our request is used up once our function returns, but we live on. */
+   al_http_state_detach (state);
+   if (state->version == AL_HTTP_1_1)
+      state->flags |= AL_STATE_CHUNKED;
+   else {
+      state->flags &= ~AL_STATE_PERSIST;
+      state->session->flags |= AL_SESSION_CLOSE;
+   }
+
+   /* HTTP/0.9 has no head at all. */
+   if (state->version != AL_HTTP_0_9) {
+      b = al_http_state_head (state, 0);
+      al_buffer_queue_append (&(state->response), b, 0, b->len);
+      al_buffer_unref (b);
+   }
+
+   /* anything written so far becomes our first chunk. */
+   al_http_stream_flush (state);
+   return 1;
+}
+
+/* frame a part of our body as a chunk, if we're chunking. */
+static void al_http_stream_chunk (al_http_state_t *state, al_buffer_t *b,
+   size_t len)
+{
+   al_buffer_queue_t *q = &(state->response);
+   char size[24];
+   size_t size_len;
+
+   if (state->flags & AL_STATE_CHUNKED) {
+      size_len = al_http_format_number (size, len, 16);
+      size[size_len++] = '\r';
+      size[size_len++] = '\n';
+      al_buffer_queue_copy (q, (unsigned char *) size, size_len);
+   }
+
+   /* small data is packed in with the framing. */
+   if (b->len <= AL_HTTP_PACK_MAX && !(b->flags & AL_BUFFER_FILE))
+      al_buffer_queue_copy (q, b->data, len);
+   else
+      al_buffer_queue_append (q, b, 0, len);
+
+   if (state->flags & AL_STATE_CHUNKED)
+      al_buffer_queue_copy (q, (const unsigned char *) "\r\n", 2);
+}
+
+/* queue everything written since we last did. */
+static int al_http_stream_queue (al_http_state_t *state)
+{
+   al_buffer_t *b;
+   int queued = 0;
+
+   /* small writes are copied, so we can keep our output buffer for more. */
+   if (state->output_len > 0) {
+      if (state->output_len <= AL_HTTP_PACK_MAX) {
+         b = al_buffer_wrap (state->output, state->output_len, NULL, NULL);
+         al_http_stream_chunk (state, b, state->output_len);
+         al_buffer_unref (b);
+         state->output_len = 0;
+         state->output_pos = 0;
+      }
+      else {
+         b = al_buffer_take (state->output, state->output_len,
+            state->output_size);
+         state->output      = NULL;
+         state->output_size = 0;
+         state->output_len  = 0;
+         state->output_pos  = 0;
+         al_http_stream_chunk (state, b, b->len);
+         al_buffer_unref (b);
+      }
+      queued = 1;
+   }
+   if (state->file) {
+      al_http_stream_chunk (state, state->file, state->file->len);
+      al_buffer_unref (state->file);
+      state->file = NULL;
+      queued = 1;
+   }
+   return queued;
+}
+
+/* al_http_stream_flush():
+ * -----------------------
+ * Sends everything written to a streaming response since the last flush.
+ * Responses ahead of ours in the queue go first.
+ *
+ * Return value: 1 if anything was queued, otherwise 0.
+ */
+int al_http_stream_flush (al_http_state_t *state)
+{
+   int queued;
+
+   if (!(state->flags & AL_STATE_STREAM) || (state->flags & AL_STATE_DONE))
+      return 0;
+   queued = al_http_stream_queue (state);
+
+   /* send it now, unless we're in the middle of reading requests.  that
+    * sends everything at the end. */
+   if (!(state->session->flags & AL_SESSION_READING))
+      al_http_session_flush (state->session);
+   return queued;
+}
+
+/* al_http_stream_end():
+ * ---------------------
+ * Finishes a streaming response, sending anything left over.  The request's
+ * state may be reused for another request afterwards.
+ *
+ * Return value: 1 on success, 0 if we weren't streaming.
+ */
+int al_http_stream_end (al_http_state_t *state)
+{
+   al_http_session_t *session = state->session;
+
+   if (!(state->flags & AL_STATE_STREAM) || (state->flags & AL_STATE_DONE))
+      return 0;
+   al_http_stream_queue (state);
+   if (state->flags & AL_STATE_CHUNKED)
+      al_buffer_queue_copy (&(state->response),
+         (const unsigned char *) "0\r\n\r\n", 5);
+   al_http_state_cleanup_output (state);
+
+   /* log our result. */
+   AL_PRINTF ("   #%d: [%s] [%s] [%s] (streamed)\n",
+      state->connection->fd_in, state->verb, state->uri_str,
+      state->version_str);
+
+   /* we're done.  send it now, unless we're in the middle of reading
+    * requests. */
+   state->flags |= AL_STATE_DONE;
+   if (!(session->flags & AL_SESSION_READING))
+      al_http_session_flush (session);
+   return 1;
+}
+
+/* al_http_set_stream_func():
+ * --------------------------
+ * Calls 'func' whenever everything a streaming response has sent so far
+ * has gone out, so it can write (and flush) more.  Responses are only sent
+ * as fast as the client reads them.  Once 'func' has nothing more to say,
+ * it should call al_http_stream_end().  If it writes nothing, it won't be
+ * called again until something else flushes the stream.
+ *
+ * Function hook type definition (al_http_stream_func):
+ * ----------------------------------------------------
+ * AL_HTTP_STREAM_FUNC (foo)  <-- parameters are (request, arg)
+ */
+int al_http_set_stream_func (al_http_state_t *state,
+   al_http_stream_func *func, void *arg)
+{
+   state->stream_func = func;
+   state->stream_arg  = arg;
    return 1;
 }
 
 int al_http_state_cleanup_output (al_http_state_t *state)
 {
-   if (state->output == NULL)
+   if (state->file) {
+      al_buffer_unref (state->file);
+      state->file = NULL;
+   }
+   if (state->output == NULL && state->output_size == 0)
       return 0;
-   free (state->output);
+   if (state->output)
+      free (state->output);
    state->output      = NULL;
    state->output_size = 0;
    state->output_len  = 0;
@@ -412,91 +1356,86 @@ int al_http_state_cleanup_output (al_http_state_t *state)
 }
 
 al_http_header_t *al_http_header_set (al_http_state_t *state,
-   al_http_header_t **headers, int type, const char *name, const char *value)
+   al_http_headers_t *headers, const char *name, const char *value)
 {
    /* if there's already a field with this name, change the value. */
    al_http_header_t *h;
    if ((h = al_http_header_get (headers, name)) != NULL) {
-      al_util_replace_string (&(h->value), value);
+      h->value     = al_arena_strdup (&(state->arena), value);
+      h->value_len = strlen (value);
       return h;
    }
 
    /* create a new header and assign data. */
-   h = calloc (1, sizeof (al_http_header_t));
-   h->type = type;
-   al_util_replace_string (&(h->name),  name);
-   al_util_replace_string (&(h->value), value);
+   h = al_arena_calloc (&(state->arena), sizeof (al_http_header_t));
+   h->name      = al_arena_strdup (&(state->arena), name);
+   h->value     = al_arena_strdup (&(state->arena), value);
+   h->name_len  = strlen (name);
+   h->value_len = strlen (value);
 
-   /* link to the front and return our new header field. */
+   /* link to the back and return our new header field. */
    h->state = state;
-   h->next = *headers;
-   if (h->next)
-      h->next->prev = h;
-   *headers = h;
+   al_http_headers_link (headers, h);
    return h;
 }
 
-al_http_header_t *al_http_header_get (al_http_header_t *const *headers,
+al_http_header_t *al_http_header_get (const al_http_headers_t *headers,
    const char *name)
 {
    if (headers == NULL || name == NULL)
       return NULL;
-   al_http_header_t *h;
-   for (h = *headers; h != NULL; h = h->next)
-      if (strcmp (h->name, name) == 0)
-         return h;
-   return NULL;
+   return al_http_headers_find (headers, name);
 }
 
 int al_http_header_free (al_http_header_t *h)
 {
-   /* free data. */
-   if (h->name)  free (h->name);
-   if (h->value) free (h->value);
-
-   /* unlink. */
+   /* headers belong to our arena, so all we need to do is unlink. */
    if (h->type == AL_HEADER_REQUEST)
-      AL_LL_UNLINK (h, prev, next, h->state, header_request);
+      al_http_headers_unlink (&(h->state->header_request), h);
    if (h->type == AL_HEADER_RESPONSE)
-      AL_LL_UNLINK (h, prev, next, h->state, header_response);
-
-   /* free the structure itself and return success. */
-   free (h);
+      al_http_headers_unlink (&(h->state->header_response), h);
    return 1;
 }
 
 al_http_header_t *al_http_header_request_set (al_http_state_t *state,
    const char *name, const char *value)
-{ return al_http_header_set (state, &(state->header_request),
-   AL_HEADER_REQUEST, name, value); }
+{ return al_http_header_set (state, &(state->header_request), name, value); }
 
 al_http_header_t *al_http_header_request_get (const al_http_state_t *state,
    const char *name)
 { return al_http_header_get (&(state->header_request), name); }
 
+al_http_header_t *al_http_header_request_get_id (const al_http_state_t *state,
+   int id)
+{ return al_http_headers_find_id (&(state->header_request), id); }
+
 al_http_header_t *al_http_header_response_set (al_http_state_t *state,
    const char *name, const char *value)
-{ return al_http_header_set (state, &(state->header_response),
-   AL_HEADER_RESPONSE, name, value); }
+{ return al_http_header_set (state, &(state->header_response), name, value); }
 
 al_http_header_t *al_http_header_response_get (const al_http_state_t *state,
    const char *name)
 { return al_http_header_get (&(state->header_response), name); }
 
+al_http_header_t *al_http_header_response_get_id (
+   const al_http_state_t *state, int id)
+{ return al_http_headers_find_id (&(state->header_response), id); }
+
 int al_http_header_clear (al_http_state_t *state)
 {
-   int count = 0;
-   while (state->header_request)
-      count += al_http_header_free (state->header_request);
-   while (state->header_response)
-      count += al_http_header_free (state->header_response);
+   /* headers belong to our arena, so we can simply forget them. */
+   int count = state->header_request.count + state->header_response.count;
+   al_http_headers_init (&(state->header_request),  AL_HEADER_REQUEST);
+   al_http_headers_init (&(state->header_response), AL_HEADER_RESPONSE);
    return count;
 }
 
 int al_http_write (al_http_state_t *state, const unsigned char *buf,
    size_t size)
 {
-   return al_connection_append_buffer (state->connection, &(state->output),
+   /* our output belongs to whoever is building our response, which might
+    * not be our connection's reactor. */
+   return al_connection_append_buffer (NULL, &(state->output),
       &(state->output_size), &(state->output_len), &(state->output_pos),
       buf, size);
 }
@@ -520,6 +1459,41 @@ int al_http_write_stringf (al_http_state_t *state, const char *format, ...)
    return al_http_write_string (state, buf);
 }
 
+/* al_http_write_file():
+ * ---------------------
+ * Sends part of a file after everything written with al_http_write().  The
+ * file isn't read into memory; the connection sends it with sendfile() once
+ * the response header has been written.
+ *
+ * fd:     Open file.  It belongs to the request from now on and is closed
+ *         once it has been sent or the request is reset.
+ * offset: First byte to send.
+ * length: Number of bytes to send, or -1 for the rest of the file.
+ *
+ * Return value: 1 on success, 0 if 'fd' isn't a regular file or the range
+ *               is outside of it.
+ */
+int al_http_write_file (al_http_state_t *state, int fd, off_t offset,
+   off_t length)
+{
+   struct stat st;
+
+   /* Content-Length comes from the size of our file. */
+   if (fstat (fd, &st) != 0 || !S_ISREG (st.st_mode) || offset < 0 ||
+       offset > st.st_size) {
+      close (fd);
+      return 0;
+   }
+   if (length < 0 || length > st.st_size - offset)
+      length = st.st_size - offset;
+
+   /* only one file per response. */
+   if (state->file)
+      al_buffer_unref (state->file);
+   state->file = al_buffer_file (fd, offset, length, AL_BUFFER_CLOSE);
+   return 1;
+}
+
 const char *al_http_status_code_string (int status_code)
 {
    switch (status_code) {
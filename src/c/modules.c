@@ -2,10 +2,54 @@
  * ---------
  * custom data assigned to servers, connections, etc. */
 
+#include <pthread.h>
 #include <stdlib.h>
 #include <string.h>
 
 #include "alpaca/modules.h"
+#include "alpaca/pool.h"
+
+/* names registered for a slot of their own, shared by every owner.  names
+ * are only ever added, and they're in place before they're counted, so
+ * they can be looked up without locking. */
+static char *al_module_names[AL_MODULE_SLOTS];
+static int al_module_name_count;
+static pthread_mutex_t al_module_names_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/* the slot registered for 'name', or -1. */
+static int al_module_id (const char *name)
+{
+   int id, count = AL_ATOMIC_LOAD (&al_module_name_count);
+   for (id = 0; id < count; id++)
+      if (strcmp (al_module_names[id], name) == 0)
+         return id;
+   return -1;
+}
+
+/* al_module_register():
+ * ---------------------
+ * Gives a module name a slot of its own, so its modules can be found with
+ * al_server_module_slot() or al_connection_module_slot() rather than by
+ * searching for their name.  Registering a name again returns the same
+ * slot.  Modules created with a registered name go in its slot
+ * automatically.
+ *
+ * Return value: The slot's id, or -1 if all AL_MODULE_SLOTS are taken.
+ */
+int al_module_register (const char *name)
+{
+   int id;
+
+   pthread_mutex_lock (&al_module_names_mutex);
+   if ((id = al_module_id (name)) < 0 &&
+       al_module_name_count < AL_MODULE_SLOTS) {
+      id = al_module_name_count;
+      al_module_names[id] = strdup (name);
+      AL_ATOMIC_STORE (&al_module_name_count, id + 1);
+   }
+   pthread_mutex_unlock (&al_module_names_mutex);
+   return id;
+}
 
 al_module_t *al_module_get (al_module_t *const *list, const char *name)
 {
@@ -19,13 +63,17 @@ al_module_t *al_module_get (al_module_t *const *list, const char *name)
    return NULL;
 }
 
-al_module_t *al_module_new (void *owner, al_module_t **list, const char *name,
-   void *data, size_t data_size, al_module_func *func_free)
+al_module_t *al_module_new (void *owner, al_module_t **list,
+   al_module_t **slots, const char *name, void *data, size_t data_size,
+   al_module_func *func_free)
 {
-   /* allocate our new module with basic settings. */
-   al_module_t *new = calloc (1, sizeof (al_module_t));
+   /* allocate our new module with basic settings.  our name is kept right
+    * after us, in the same block from our pool. */
+   size_t name_size = strlen (name) + 1;
+   al_module_t *new = al_pool_calloc (sizeof (al_module_t) + name_size);
    new->owner     = owner;
-   new->name      = strdup (name);
+   new->name      = memcpy (new + 1, name, name_size);
+   new->id        = al_module_id (name);
    new->data      = data;
    new->data_size = data_size;
    new->func_free = func_free;
@@ -37,6 +85,12 @@ al_module_t *al_module_new (void *owner, al_module_t **list, const char *name,
       new->next->prev = new;
    *list = new;
 
+   /* take our slot, unless another module with our name has it. */
+   if (slots && new->id >= 0 && slots[new->id] == NULL) {
+      new->slots = slots;
+      slots[new->id] = new;
+   }
+
    /* return our new module. */
    return new;
 }
@@ -51,12 +105,13 @@ int al_module_free (al_module_t *m)
    if (m->prev) m->prev->next = m->next;
    else         *(m->list)    = m->next;
    if (m->next) m->next->prev = m->prev;
+   if (m->slots)
+      m->slots[m->id] = NULL;
 
    /* free allocated data. */
-   if (m->name) free (m->name);
    if (m->data) free (m->data);
 
    /* free the structure itself and return success. */
-   free (m);
+   al_pool_free (m, sizeof (al_module_t) + strlen (m->name) + 1);
    return 1;
 }
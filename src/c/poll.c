@@ -0,0 +1,258 @@
+/* poll.c
+ * ------
+ * pluggable I/O readiness notification (epoll or select) for server loops. */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#ifdef HAVE_CONFIG_H
+   #include "config.h"
+#endif
+#ifdef HAVE_SYS_EPOLL_H
+   #include <sys/epoll.h>
+#endif
+
+#include "alpaca/poll.h"
+
+al_poll_t *al_poll_new (int type)
+{
+   /* fall back to select() if epoll isn't available. */
+#ifndef HAVE_SYS_EPOLL_H
+   type = AL_POLL_SELECT;
+#endif
+
+   /* allocate an empty poller. */
+   al_poll_t *new = calloc (1, sizeof (al_poll_t));
+   new->type     = type;
+   new->epoll_fd = -1;
+   new->fd_max   = -1;
+   FD_ZERO (&(new->fd_in));
+   FD_ZERO (&(new->fd_out));
+
+#ifdef HAVE_SYS_EPOLL_H
+   /* attempt to get an epoll instance.  if we can't, use select(). */
+   if (new->type == AL_POLL_EPOLL) {
+      if ((new->epoll_fd = epoll_create1 (EPOLL_CLOEXEC)) < 0) {
+         AL_ERROR ("Warning: epoll_create1() failed (Error %d).\n"
+                   "Falling back to select().\n", errno);
+         new->type = AL_POLL_SELECT;
+      }
+   }
+#endif
+
+   /* return our new poller. */
+   return new;
+}
+
+int al_poll_free (al_poll_t *p)
+{
+   if (p->epoll_fd >= 0)
+      close (p->epoll_fd);
+   if (p->events)
+      free (p->events);
+   if (p->data)
+      free (p->data);
+   free (p);
+   return 1;
+}
+
+#ifdef HAVE_SYS_EPOLL_H
+static int al_poll_epoll_ctl (al_poll_t *p, int op, int fd, al_flags_t events)
+{
+   struct epoll_event ev;
+   memset (&ev, 0, sizeof (ev));
+   ev.data.fd = fd;
+   if (events & AL_POLL_IN)  ev.events |= EPOLLIN;
+   if (events & AL_POLL_OUT) ev.events |= EPOLLOUT;
+   if (epoll_ctl (p->epoll_fd, op, fd, &ev) != 0) {
+      AL_ERROR ("epoll_ctl() error on descriptor %d: %d\n", fd, errno);
+      return 0;
+   }
+   return 1;
+}
+#endif
+
+int al_poll_add (al_poll_t *p, int fd, al_flags_t events, void *data)
+{
+   /* select() can't handle descriptors past FD_SETSIZE. */
+   if (fd < 0)
+      return 0;
+   if (p->type == AL_POLL_SELECT && fd >= FD_SETSIZE) {
+      AL_ERROR ("al_poll_add(): descriptor %d exceeds FD_SETSIZE.\n", fd);
+      return 0;
+   }
+
+   /* make sure our owner table is large enough for this descriptor. */
+   if (fd >= p->data_size) {
+      int new_size = AL_MAX (64, p->data_size);
+      while (new_size <= fd)
+         new_size *= 2;
+      p->data = realloc (p->data, sizeof (void *) * new_size);
+      memset (p->data + p->data_size, 0,
+         sizeof (void *) * (new_size - p->data_size));
+      p->data_size = new_size;
+   }
+
+#ifdef HAVE_SYS_EPOLL_H
+   if (p->type == AL_POLL_EPOLL) {
+      if (!al_poll_epoll_ctl (p, EPOLL_CTL_ADD, fd, events))
+         return 0;
+   }
+#endif
+
+   /* record our owner and interest. */
+   p->data[fd] = data;
+   if (fd < FD_SETSIZE) {
+      if (events & AL_POLL_IN)  FD_SET (fd, &(p->fd_in));
+      if (events & AL_POLL_OUT) FD_SET (fd, &(p->fd_out));
+      p->fd_max = AL_MAX (p->fd_max, fd);
+   }
+   p->count++;
+   return 1;
+}
+
+int al_poll_modify (al_poll_t *p, int fd, al_flags_t events, void *data)
+{
+   if (fd < 0 || fd >= p->data_size)
+      return 0;
+
+#ifdef HAVE_SYS_EPOLL_H
+   if (p->type == AL_POLL_EPOLL)
+      if (!al_poll_epoll_ctl (p, EPOLL_CTL_MOD, fd, events))
+         return 0;
+#endif
+
+   /* update select() interest. */
+   p->data[fd] = data;
+   if (fd < FD_SETSIZE) {
+      if (events & AL_POLL_IN)  FD_SET (fd, &(p->fd_in));
+      else                      FD_CLR (fd, &(p->fd_in));
+      if (events & AL_POLL_OUT) FD_SET (fd, &(p->fd_out));
+      else                      FD_CLR (fd, &(p->fd_out));
+   }
+   return 1;
+}
+
+int al_poll_remove (al_poll_t *p, int fd)
+{
+   int i;
+   if (fd < 0 || fd >= p->data_size)
+      return 0;
+
+#ifdef HAVE_SYS_EPOLL_H
+   if (p->type == AL_POLL_EPOLL)
+      epoll_ctl (p->epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+#endif
+
+   /* forget about this descriptor. */
+   p->data[fd] = NULL;
+   if (fd < FD_SETSIZE) {
+      FD_CLR (fd, &(p->fd_in));
+      FD_CLR (fd, &(p->fd_out));
+      while (p->fd_max >= 0 && !FD_ISSET (p->fd_max, &(p->fd_in)) &&
+             !FD_ISSET (p->fd_max, &(p->fd_out)))
+         p->fd_max--;
+   }
+   p->count--;
+
+   /* the owner is usually being freed.  make sure events we haven't
+    * processed yet don't point to it anymore. */
+   for (i = 0; i < p->events_len; i++) {
+      if (p->events[i].fd == fd) {
+         p->events[i].fd     = -1;
+         p->events[i].events = 0;
+         p->events[i].data   = NULL;
+      }
+   }
+   return 1;
+}
+
+static al_poll_event_t *al_poll_event_push (al_poll_t *p, int fd,
+   al_flags_t events, void *data)
+{
+   /* make sure we have room. */
+   if (p->events_len >= p->events_size) {
+      p->events_size = AL_MAX (64, p->events_size * 2);
+      p->events = realloc (p->events,
+         sizeof (al_poll_event_t) * p->events_size);
+   }
+
+   /* add the event and return it. */
+   al_poll_event_t *ev = p->events + p->events_len++;
+   ev->fd     = fd;
+   ev->events = events;
+   ev->data   = data;
+   return ev;
+}
+
+#ifdef HAVE_SYS_EPOLL_H
+static int al_poll_wait_epoll (al_poll_t *p, struct timeval *timeout)
+{
+   struct epoll_event evs[256];
+   int i, res, ms;
+
+   /* convert our timeout to milliseconds, rounding up so we don't
+    * spin before the deadline. */
+   if (timeout == NULL)
+      ms = -1;
+   else
+      ms = (int) (timeout->tv_sec * 1000 + (timeout->tv_usec + 999) / 1000);
+
+   if ((res = epoll_wait (p->epoll_fd, evs, 256, ms)) < 0)
+      return -1;
+
+   /* translate epoll events.  hangups are treated as input so pending data
+    * is still read; the read itself will report the closed connection. */
+   for (i = 0; i < res; i++) {
+      al_flags_t events = 0;
+      int fd = evs[i].data.fd;
+      if (evs[i].events & (EPOLLIN | EPOLLHUP)) events |= AL_POLL_IN;
+      if (evs[i].events & EPOLLOUT)             events |= AL_POLL_OUT;
+      if (evs[i].events & EPOLLERR)             events |= AL_POLL_ERROR;
+      al_poll_event_push (p, fd, events,
+         (fd < p->data_size) ? p->data[fd] : NULL);
+   }
+   return res;
+}
+#endif
+
+static int al_poll_wait_select (al_poll_t *p, struct timeval *timeout)
+{
+   fd_set fd_in, fd_out, fd_other;
+   int fd, res, count;
+
+   /* select() modifies our sets, so work on copies. */
+   fd_in    = p->fd_in;
+   fd_out   = p->fd_out;
+   fd_other = p->fd_in;
+   if ((res = select (p->fd_max + 1, &fd_in, &fd_out, &fd_other,
+                      timeout)) < 0)
+      return -1;
+
+   /* report every descriptor with activity. */
+   for (fd = 0, count = 0; fd <= p->fd_max && count < res; fd++) {
+      al_flags_t events = 0;
+      if (FD_ISSET (fd, &fd_in))    events |= AL_POLL_IN;
+      if (FD_ISSET (fd, &fd_out))   events |= AL_POLL_OUT;
+      if (FD_ISSET (fd, &fd_other)) events |= AL_POLL_ERROR;
+      if (events == 0)
+         continue;
+      al_poll_event_push (p, fd, events, p->data[fd]);
+      count++;
+   }
+   return count;
+}
+
+int al_poll_wait (al_poll_t *p, struct timeval *timeout)
+{
+   /* forget events from the last call. */
+   p->events_len = 0;
+
+#ifdef HAVE_SYS_EPOLL_H
+   if (p->type == AL_POLL_EPOLL)
+      return al_poll_wait_epoll (p, timeout);
+#endif
+   return al_poll_wait_select (p, timeout);
+}
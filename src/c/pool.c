@@ -0,0 +1,136 @@
+/* pool.c
+ * ------
+ * per-thread caches of power-of-two blocks for memory that's allocated and
+ * freed all the time. */
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "alpaca/pool.h"
+
+/* each thread's cache, freed along with the thread. */
+static pthread_key_t  al_pool_key;
+static pthread_once_t al_pool_key_once = PTHREAD_ONCE_INIT;
+
+static void al_pool_cache_free (void *arg)
+{
+   al_pool_cache_t *cache = arg;
+   void *p;
+   int i;
+
+   for (i = 0; i < AL_POOL_CLASSES; i++)
+      while ((p = cache->free[i]) != NULL) {
+         cache->free[i] = *((void **) p);
+         free (p);
+      }
+   free (cache);
+}
+
+static void al_pool_key_init (void)
+   { pthread_key_create (&al_pool_key, al_pool_cache_free); }
+
+static al_pool_cache_t *al_pool_cache (void)
+{
+   al_pool_cache_t *cache;
+
+   pthread_once (&al_pool_key_once, al_pool_key_init);
+   if ((cache = pthread_getspecific (al_pool_key)) == NULL) {
+      cache = calloc (1, sizeof (al_pool_cache_t));
+      pthread_setspecific (al_pool_key, cache);
+   }
+   return cache;
+}
+
+/* the class of blocks 'size' bytes fit in, or -1 if they're too large. */
+static int al_pool_class (size_t size)
+{
+   int c = AL_POOL_CLASS_MIN;
+   while (c <= AL_POOL_CLASS_MAX && ((size_t) 1 << c) < size)
+      c++;
+   return (c <= AL_POOL_CLASS_MAX) ? c - AL_POOL_CLASS_MIN : -1;
+}
+
+/* al_pool_size():
+ * ---------------
+ * Return value: The number of bytes actually allocated for a block of
+ *               'size' bytes.  All of them can be used.
+ */
+size_t al_pool_size (size_t size)
+{
+   int c = al_pool_class (size);
+   return (c < 0) ? size : ((size_t) 1 << (c + AL_POOL_CLASS_MIN));
+}
+
+/* al_pool_alloc():
+ * al_pool_calloc():
+ * -----------------
+ * Return value: A block of at least 'size' bytes, taken from this thread's
+ *               cache if it has one.
+ */
+void *al_pool_alloc (size_t size)
+{
+   al_pool_cache_t *cache;
+   void *p;
+   int c;
+
+   if ((c = al_pool_class (size)) < 0)
+      return malloc (size);
+   cache = al_pool_cache ();
+   if ((p = cache->free[c]) == NULL)
+      return malloc ((size_t) 1 << (c + AL_POOL_CLASS_MIN));
+   cache->free[c] = *((void **) p);
+   cache->count[c]--;
+   return p;
+}
+
+void *al_pool_calloc (size_t size)
+   { return memset (al_pool_alloc (size), 0, size); }
+
+/* al_pool_realloc():
+ * ------------------
+ * Moves a block to one of a new size, unless they're the same size already.
+ * Only the first 'keep' bytes are copied.
+ *
+ * Return value: The new block.
+ */
+void *al_pool_realloc (void *p, size_t old_size, size_t new_size,
+   size_t keep)
+{
+   void *new;
+
+   if (p == NULL)
+      return al_pool_alloc (new_size);
+   if (al_pool_size (old_size) == al_pool_size (new_size))
+      return p;
+   new = al_pool_alloc (new_size);
+   memcpy (new, p, AL_MIN (keep, new_size));
+   al_pool_free (p, old_size);
+   return new;
+}
+
+/* al_pool_free():
+ * ---------------
+ * Returns a block to this thread's cache, or frees it if the cache is full.
+ */
+int al_pool_free (void *p, size_t size)
+{
+   al_pool_cache_t *cache;
+   int c;
+
+   if (p == NULL)
+      return 0;
+   if ((c = al_pool_class (size)) < 0) {
+      free (p);
+      return 1;
+   }
+   cache = al_pool_cache ();
+   if ((size_t) cache->count[c] << (c + AL_POOL_CLASS_MIN) >= AL_POOL_KEEP) {
+      free (p);
+      return 1;
+   }
+   *((void **) p) = cache->free[c];
+   cache->free[c] = p;
+   cache->count[c]++;
+   return 1;
+}
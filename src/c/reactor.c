@@ -0,0 +1,930 @@
+/* reactor.c
+ * ---------
+ * server loop threads.  each reactor owns a listening socket, a poller,
+ * and the connections it has accepted. */
+
+/* we need accept4(). */
+#define _GNU_SOURCE
+
+#ifdef HAVE_CONFIG_H
+   #include "config.h"
+#endif
+
+#include <sys/socket.h>
+#ifdef HAVE_SYS_EVENTFD_H
+   #include <sys/eventfd.h>
+#endif
+#include <fcntl.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "alpaca/buffer.h"
+#include "alpaca/connections.h"
+#include "alpaca/mutex.h"
+#include "alpaca/poll.h"
+#include "alpaca/read.h"
+#include "alpaca/server.h"
+#include "alpaca/timers.h"
+
+#include "alpaca/reactor.h"
+
+/* every reactor thread remembers which reactor it's running. */
+static pthread_key_t  al_reactor_key;
+static pthread_once_t al_reactor_key_once = PTHREAD_ONCE_INIT;
+static void al_reactor_key_init (void)
+   { pthread_key_create (&al_reactor_key, NULL); }
+
+/* al_reactor_new():
+ * -----------------
+ * Creates a new reactor for a server.  Reactors are created along with their
+ * server and persist until the server is freed or the reactor count changes.
+ *
+ * server: The server instance.
+ * index:  Position of this reactor in the server's list.
+ * mutex:  Mutex shared with the server, or NULL to create our own.
+ *
+ * Return value: A pointer to the new reactor.
+ */
+al_reactor_t *al_reactor_new (al_server_t *server, int index,
+   al_mutex_t *mutex)
+{
+   al_reactor_t *new = calloc (1, sizeof (al_reactor_t));
+   new->server     = server;
+   new->index      = index;
+   new->sock_fd    = -1;
+   new->wake_fd[0] = -1;
+   new->wake_fd[1] = -1;
+   new->timers     = al_timer_wheel_new ();
+   new->slot_free  = -1;
+
+   /* use the server's mutex if we were given one. */
+   if (mutex)
+      new->mutex = mutex;
+   else {
+      new->mutex  = al_mutex_new ();
+      AL_ATOMIC_OR (&(new->state), AL_REACTOR_STATE_MUTEX);
+   }
+
+   /* return our new reactor. */
+   return new;
+}
+
+/* al_reactor_free():
+ * ------------------
+ * Closes a reactor, drops data posted to it, and frees its memory.
+ */
+int al_reactor_free (al_reactor_t *r)
+{
+   al_reactor_post_t *p, *next;
+
+   /* make sure we're closed. */
+   al_reactor_close (r);
+
+   /* forget about posted data. */
+   for (p = AL_ATOMIC_EXCHANGE (&(r->post_list), NULL); p != NULL;
+        p = next) {
+      next = p->next;
+      if (p->buffer)
+         al_buffer_unref (p->buffer);
+      free (p);
+   }
+
+   /* free our timers, ids, mutexes, and ourselves. */
+   al_timer_wheel_free (r->timers);
+   free (r->slots);
+   if (AL_ATOMIC_LOAD (&(r->state)) & AL_REACTOR_STATE_MUTEX)
+      al_mutex_free (r->mutex);
+   free (r);
+   return 1;
+}
+
+/* al_reactor_open():
+ * ------------------
+ * Prepares a reactor for accepting connections on 'sock_fd'.  This function
+ * creates an eventfd (or pipe) used for interrupting the reactor's thread and
+ * the poller
+ * used to wait on all descriptors.
+ *
+ * sock_fd:     Listening socket.
+ * owns_socket: 1 if the socket should be closed in al_reactor_close().
+ *
+ * Return value: 1 on success, 0 if the reactor was already open.
+ */
+int al_reactor_open (al_reactor_t *r, int sock_fd, int owns_socket)
+{
+   int flags, i;
+
+   /* don't do anything if the reactor is currently open. */
+   if (AL_ATOMIC_LOAD (&(r->state)) & AL_REACTOR_STATE_OPEN)
+      return 0;
+
+   /* attempt to create an eventfd or pipe we can use for interrupts.  we
+    * use it to "wake up" the reactor thread for events like shutting down,
+    * forcing output to be queued, and anything else that needs our poller to
+    * stop waiting. */
+#ifdef HAVE_SYS_EVENTFD_H
+   if ((r->wake_fd[0] = eventfd (0, EFD_NONBLOCK | EFD_CLOEXEC)) >= 0) {
+      r->wake_fd[1] = r->wake_fd[0];
+      AL_ATOMIC_OR (&(r->state),
+         AL_REACTOR_STATE_WAKE | AL_REACTOR_STATE_EVENTFD);
+   }
+   else
+#endif
+   if (pipe (r->wake_fd) != 0) {
+      AL_ERROR ("Warning: Unable to create pipe (Error %d). \n"
+                "Continuing anyway.\n", errno);
+      r->wake_fd[0] = -1;
+      r->wake_fd[1] = -1;
+   }
+   /* pipe() worked - set some things up. */
+   else {
+      /* make both ends of the pipe non-blocking so the pipe is never
+       * something being waited upon. */
+      for (i = 0; i < 2; i++) {
+         flags = fcntl (r->wake_fd[i], F_GETFL);
+         flags |= O_NONBLOCK;
+         fcntl (r->wake_fd[i], F_SETFL, flags);
+      }
+
+      /* remember that we have a pipe. */
+      AL_ATOMIC_OR (&(r->state), AL_REACTOR_STATE_WAKE);
+   }
+   AL_ATOMIC_STORE (&(r->signalled), 0);
+
+   /* create a poller.  descriptors stay registered until they're closed,
+    * so the loop doesn't need to rebuild anything between waits. */
+   r->poll = al_poll_new ((r->server->flags & AL_SERVER_USE_SELECT)
+      ? AL_POLL_SELECT : AL_POLL_EPOLL);
+   al_poll_add (r->poll, sock_fd, AL_POLL_IN, NULL);
+   if (AL_ATOMIC_LOAD (&(r->state)) & AL_REACTOR_STATE_WAKE)
+      al_poll_add (r->poll, r->wake_fd[0], AL_POLL_IN, NULL);
+
+   /* record our listening socket and mark that we're now open. */
+   r->sock_fd = sock_fd;
+   if (owns_socket)
+      AL_ATOMIC_OR (&(r->state), AL_REACTOR_STATE_SOCKET);
+   AL_ATOMIC_OR (&(r->state), AL_REACTOR_STATE_OPEN);
+   return 1;
+}
+
+/* al_reactor_close():
+ * -------------------
+ * Frees all of the reactor's connections and closes its eventfd, poller, and
+ * (if it owns it) its listening socket.  The reactor's thread must not be
+ * running.
+ *
+ * Return value: 1 on success, 0 if the reactor wasn't open.
+ */
+int al_reactor_close (al_reactor_t *r)
+{
+   if (!(AL_ATOMIC_LOAD (&(r->state)) & AL_REACTOR_STATE_OPEN))
+      return 0;
+   al_reactor_lock (r);
+
+   /* close connections. */
+   while (r->connection_list)
+      al_connection_free (r->connection_list);
+
+   /* close our socket if it's ours. */
+   if (AL_ATOMIC_LOAD (&(r->state)) & AL_REACTOR_STATE_SOCKET)
+      socket_close (r->sock_fd);
+   r->sock_fd = -1;
+
+   /* we're done polling. */
+   al_poll_free (r->poll);
+   r->poll = NULL;
+
+   /* close our eventfd or pipe. */
+   if (AL_ATOMIC_LOAD (&(r->state)) & AL_REACTOR_STATE_WAKE) {
+      close (r->wake_fd[0]);
+      if (!(AL_ATOMIC_LOAD (&(r->state)) & AL_REACTOR_STATE_EVENTFD))
+         close (r->wake_fd[1]);
+      r->wake_fd[0] = -1;
+      r->wake_fd[1] = -1;
+   }
+
+   /* indicate that we're no longer open. */
+   AL_ATOMIC_AND (&(r->state), ~(AL_REACTOR_STATE_OPEN |
+      AL_REACTOR_STATE_WAKE | AL_REACTOR_STATE_EVENTFD |
+      AL_REACTOR_STATE_SOCKET));
+   al_reactor_unlock (r);
+   return 1;
+}
+
+/* al_reactor_lock():
+ * al_reactor_unlock():
+ * --------------------
+ * Claims or relinquishes ownership of the reactor's connections.  Can be
+ * used recursively.  Threads of other reactors should never lock a
+ * reactor; they should use al_reactor_post() instead.
+ *
+ * Return value: 1 on success, 0 on failure.
+ */
+int al_reactor_lock (al_reactor_t *r)
+   { return (al_mutex_lock (r->mutex) == 0) ? 1 : 0; }
+int al_reactor_unlock (al_reactor_t *r)
+   { return (al_mutex_unlock (r->mutex) == 0) ? 1 : 0; }
+
+/* al_reactor_start():
+ * -------------------
+ * Starts a thread running al_reactor_pthread_func().
+ *
+ * Return value: 1 on success, 0 on failure.
+ */
+int al_reactor_start (al_reactor_t *r)
+{
+   int res;
+
+   /* flag our thread before it starts, so it never sees our state change. */
+   AL_ATOMIC_OR (&(r->state), AL_REACTOR_STATE_THREAD);
+   if ((res = pthread_create (&(r->pthread), NULL, al_reactor_pthread_func,
+                              (void *) r)) != 0) {
+      AL_ATOMIC_AND (&(r->state), ~AL_REACTOR_STATE_THREAD);
+      AL_ERROR ("Unable to start reactor #%d (Error: %d)\n", r->index, res);
+      return 0;
+   }
+   return 1;
+}
+
+/* al_reactor_loop_hostname():
+ * ---------------------------
+ * Assigns a hostname resolved in the background to a connection.
+ */
+static void al_reactor_loop_hostname (al_reactor_t *r, al_connection_t *c,
+   const unsigned char *name, size_t size)
+{
+   al_server_t *server = r->server;
+
+   if (c->hostname)
+      free (c->hostname);
+   c->hostname = malloc (size + 1);
+   memcpy (c->hostname, name, size);
+   c->hostname[size] = '\0';
+
+   if (server->func[AL_SERVER_FUNC_HOSTNAME])
+      server->func[AL_SERVER_FUNC_HOSTNAME] (server, c,
+         AL_SERVER_FUNC_HOSTNAME, c->hostname);
+}
+
+/* queue part of a posted buffer for a connection.  whoever posted it was
+ * told it would be written, so our high watermark doesn't apply. */
+static int al_reactor_loop_splice (al_connection_t *c, al_buffer_t *b,
+   size_t pos, size_t len)
+{
+   al_buffer_queue_t q = {0};
+   al_buffer_queue_append (&q, b, pos, len);
+   return al_connection_write_queue (c, &q);
+}
+
+/* al_reactor_loop_posts():
+ * ------------------------
+ * Handles data posted by other threads for our connections.
+ */
+static void al_reactor_loop_posts (al_reactor_t *r)
+{
+   al_reactor_post_t *p, *next;
+   al_connection_t *c;
+
+   /* take everything posted so far, putting it back in the order it was
+    * posted.  hooks run from here may free connections, so keep our work
+    * where al_reactor_post_cancel() can find it. */
+   for (p = AL_ATOMIC_EXCHANGE (&(r->post_list), NULL); p != NULL;
+        p = next) {
+      next = p->next;
+      p->next = r->post_work;
+      r->post_work = p;
+   }
+
+   /* writes without a connection are broadcasts. */
+   while ((p = r->post_work) != NULL) {
+      r->post_work = p->next;
+      switch (p->type) {
+         case AL_REACTOR_POST_WRITE:
+            if (p->connection)
+               al_reactor_loop_splice (p->connection, p->buffer, 0,
+                  p->buffer->len);
+            else
+               al_reactor_write_buffer (r, p->buffer);
+            break;
+         case AL_REACTOR_POST_HOSTNAME:
+            if (p->connection)
+               al_reactor_loop_hostname (r, p->connection, p->buffer->data,
+                  p->buffer->len);
+            break;
+         case AL_REACTOR_POST_FUNC:
+            p->func (r, p->connection, p->arg);
+            break;
+         case AL_REACTOR_POST_SUBMIT:
+            if ((c = al_reactor_id_find (r, p->id)) != NULL)
+               al_reactor_loop_splice (c, p->buffer, 0, p->buffer->len);
+            break;
+         case AL_REACTOR_POST_SPLICE:
+            if (p->connection)
+               al_reactor_loop_splice (p->connection, p->buffer, p->pos,
+                  p->len);
+            break;
+      }
+      if (p->buffer)
+         al_buffer_unref (p->buffer);
+      free (p);
+   }
+}
+
+/* al_reactor_loop_pending():
+ * --------------------------
+ * Visits every connection that has asked for the loop's attention via
+ * al_connection_pending().  Connections being closed with no more output
+ * are freed, staged output is prepared, and poller interest is updated.
+ */
+static void al_reactor_loop_pending (al_reactor_t *r)
+{
+   al_connection_t *c;
+
+   /* connections may be queued again by their pre-write hook, but they'll
+    * already be writing by then, so this always finishes. */
+   while ((c = r->pending_list) != NULL) {
+      AL_LL_UNLINK_GLOBAL (c, pending_prev, pending_next, r->pending_list);
+      c->flags &= ~AL_CONNECTION_PENDING;
+
+      /* close connections with nothing left to say. */
+      if (c->output.len == 0 && c->flags & AL_CONNECTION_CLOSING) {
+         al_connection_free (c);
+         continue;
+      }
+
+      /* let anyone waiting for our output to drain to its low watermark
+       * know that it has.  anything they write queues us again. */
+      if (c->output.len <= c->output_low &&
+          (c->flags & AL_CONNECTION_NOTIFY_WRITABLE)) {
+         c->flags &= ~AL_CONNECTION_NOTIFY_WRITABLE;
+         if (r->server->func[AL_SERVER_FUNC_WRITABLE])
+            r->server->func[AL_SERVER_FUNC_WRITABLE] (r->server, c,
+               AL_SERVER_FUNC_WRITABLE, NULL);
+      }
+
+      /* stage output and start (or stop) waiting for writability. */
+      if (c->fd_out >= 0)
+         al_connection_stage_output (c);
+      al_connection_update_poll (c);
+   }
+}
+
+/* al_reactor_loop_read():
+ * -----------------------
+ * Reads from a connection with pending input and feeds it to the
+ * AL_SERVER_FUNC_READ hook until it stops consuming data.
+ *
+ * Return value: 1 on success, -1 if the connection was freed.
+ */
+static int al_reactor_loop_read (al_reactor_t *r, al_connection_t *c)
+{
+   int bytes_read;
+
+   if ((bytes_read = al_connection_fd_read (c)) < 0) {
+      al_connection_free (c);
+      return -1;
+   }
+   al_connection_feed (c, bytes_read);
+   return 1;
+}
+
+/* al_reactor_loop_accept():
+ * -------------------------
+ * Accepts connections waiting on our listening socket, up to the server's
+ * accept budget.  Anything left over is accepted on our next wakeup so
+ * existing connections aren't starved.  Other reactors may share our
+ * socket, so it's not an error if someone else got there first.
+ */
+static void al_reactor_loop_accept (al_reactor_t *r)
+{
+   al_server_t *server = r->server;
+   struct sockaddr_in client_addr;
+   socklen_t client_addr_size;
+   int fd, count;
+
+   for (count = 0; count < server->accept_budget; count++) {
+      client_addr_size = sizeof (struct sockaddr_in);
+      memset (&client_addr, 0, sizeof (struct sockaddr_in));
+
+      /* connections are non-blocking and aren't inherited by children. */
+#ifdef HAVE_ACCEPT4
+      fd = accept4 (r->sock_fd, (struct sockaddr *) &client_addr,
+                    &client_addr_size, SOCK_NONBLOCK | SOCK_CLOEXEC);
+#else
+      if ((fd = accept (r->sock_fd, (struct sockaddr *) &client_addr,
+                        &client_addr_size)) >= 0) {
+         fcntl (fd, F_SETFL, fcntl (fd, F_GETFL) | O_NONBLOCK);
+         fcntl (fd, F_SETFD, fcntl (fd, F_GETFD) | FD_CLOEXEC);
+      }
+#endif
+      if (fd < 0) {
+         if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR &&
+             errno != ECONNABORTED)
+            AL_ERROR ("accept() error: %d\n", errno);
+         break;
+      }
+      al_connection_new (server, fd, fd, &client_addr, client_addr_size, 0);
+   }
+
+   /* count what we've done. */
+   r->accept_wakeups++;
+   r->accepts += count;
+   if (count > r->accept_max)
+      r->accept_max = count;
+   if (count >= server->accept_budget)
+      r->accept_budget_hits++;
+}
+
+/* al_reactor_loop_func():
+ * -----------------------
+ * This function is called from the reactor loop in al_reactor_pthread_func().
+ * It does several important things:
+ *
+ *    1) Stage data to be sent out to connections that have written,
+ *    2) Use the reactor's poller to wait until connections are ready for I/O
+ *       or the next timer expires,
+ *    3) Run expired timers, such as connection timeouts,
+ *    4) Read from connections with pending input and run function hooks,
+ *    5) Write staged output to connections ready for output.
+ *
+ * Only connections reported by the poller, queued with
+ * al_connection_pending(), or with expired timers are visited.
+ *
+ * Return value: 1 on success, 0 on failure of any kind.
+ */
+int al_reactor_loop_func (al_reactor_t *r)
+{
+   al_server_t *server = r->server;
+   al_connection_t *c;
+   int i, res;
+
+   /* before we wait, make sure our data is sane. */
+   al_reactor_lock (r);
+   AL_ATOMIC_OR (&(r->state), AL_REACTOR_STATE_IN_LOOP);
+
+   /* write data from other reactors, then stage output and update interest
+    * for connections that need it. */
+   al_reactor_loop_posts (r);
+   al_reactor_loop_pending (r);
+
+   /* wait until our next timer, if we have any. */
+   struct timeval delay, *delay_ptr = NULL;
+   long ms;
+   if ((ms = al_timer_wheel_next (r->timers)) >= 0) {
+      delay_ptr = &delay;
+      delay.tv_sec  = ms / 1000;
+      delay.tv_usec = (ms % 1000) * 1000;
+   }
+
+   /* don't greedily lock the reactor while we're waiting. */
+   al_reactor_unlock (r);
+
+   /* wait forever until we have some activity. */
+   if ((res = al_poll_wait (r->poll, delay_ptr)) < 0) {
+      if (errno != EINTR)
+         AL_ERROR ("al_poll_wait() error: %d\n", errno);
+      AL_ATOMIC_OR (&(server->state), AL_SERVER_STATE_QUIT);
+      AL_ATOMIC_AND (&(r->state), ~AL_REACTOR_STATE_IN_LOOP);
+      return 0;
+   }
+
+   /* lock our reactor. */
+   al_reactor_lock (r);
+
+   /* run expired timers.  connections that timed out are freed here. */
+   al_timer_wheel_run (r->timers);
+
+   /* handle every descriptor with activity.  descriptors removed from the
+    * poller while we're doing this are marked with fd = -1. */
+   for (i = 0; i < r->poll->events_len; i++) {
+      al_poll_event_t *ev = r->poll->events + i;
+      if (ev->fd < 0)
+         continue;
+
+      /* we've been woken up.  clear our eventfd (or pipe), then let others
+       * wake us up again.  anything they posted before this point will be
+       * seen at the start of our next iteration. */
+      if ((AL_ATOMIC_LOAD (&(r->state)) & AL_REACTOR_STATE_WAKE) &&
+          ev->fd == r->wake_fd[0]) {
+         unsigned char buf[256];
+         while (read (r->wake_fd[0], buf, sizeof (buf)) == sizeof (buf));
+         AL_ATOMIC_STORE (&(r->signalled), 0);
+         continue;
+      }
+
+      /* check for incoming connections. */
+      if (ev->fd == r->sock_fd) {
+         al_reactor_loop_accept (r);
+         continue;
+      }
+      if ((c = ev->data) == NULL)
+         continue;
+
+      /* close connections with errors. */
+      if (ev->events & AL_POLL_ERROR) {
+         al_connection_free (c);
+         continue;
+      }
+
+      /* can we input? */
+      if ((ev->events & AL_POLL_IN) && ev->fd == c->fd_in)
+         if (al_reactor_loop_read (r, c) < 0)
+            continue;
+
+      /* can we output?  once we have, let al_reactor_loop_pending() decide
+       * whether we're done writing or should be closed. */
+      if ((ev->events & AL_POLL_OUT) && ev->fd == c->fd_out) {
+         if (al_connection_fd_write (c) < 0) {
+            al_connection_free (c);
+            continue;
+         }
+         al_connection_pending (c);
+      }
+   }
+
+   /* unlock reactor and return success. */
+   AL_ATOMIC_AND (&(r->state), ~AL_REACTOR_STATE_IN_LOOP);
+   al_reactor_unlock (r);
+   return 1;
+}
+
+/* al_reactor_pthread_func():
+ * --------------------------
+ * Function hook passed to each reactor's POSIX thread.  This function is the
+ * main reactor loop, which will continuously manage connections via
+ * al_reactor_loop_func() until given the shutdown notice via toggling
+ * AL_SERVER_STATE_QUIT in the server state.  The last reactor to stop marks
+ * the server as no longer running.  If al_server_open() was called from
+ * al_server_start(), all connections including listening sockets are closed.
+ */
+void *al_reactor_pthread_func (void *arg)
+{
+   al_reactor_t *r = arg;
+   al_server_t *server = r->server;
+
+   /* remember who we are. */
+   pthread_once (&al_reactor_key_once, al_reactor_key_init);
+   pthread_setspecific (al_reactor_key, r);
+
+   /* run until the server is told to quit. */
+   while (!al_server_is_quitting (server))
+      al_reactor_loop_func (r);
+
+   /* perform clean up.  if we're the last reactor, mark that the server is
+    * no longer running.  the other reactors' threads may still be winding
+    * down, so closing the server is left to al_server_wait(). */
+   al_server_lock (server);
+   if (--server->reactors_running == 0)
+      AL_ATOMIC_AND (&(server->state), ~AL_SERVER_STATE_RUNNING);
+   al_server_unlock (server);
+
+   /* we're done. */
+   return NULL;
+}
+
+/* al_reactor_interrupt():
+ * -----------------------
+ * Signals the eventfd (or pipe) created in al_reactor_open() in order to
+ * break out of the poller's wait in al_reactor_loop_func().  Interrupts are
+ * coalesced: only the first since the reactor last woke up makes a system
+ * call, and none are needed from the reactor's own thread, which always
+ * gets back to its loop before waiting again.
+ *
+ * Return value: Returns 1 on success, 0 on any failure.
+ */
+int al_reactor_interrupt (al_reactor_t *r)
+{
+   /* must be running. */
+   if (!al_server_is_running (r->server))
+      return 0;
+
+   /* must have something we can signal. */
+   if (!(AL_ATOMIC_LOAD (&(r->state)) & AL_REACTOR_STATE_WAKE))
+      return 0;
+
+   /* don't bother if it's us or if someone else already signalled. */
+   if (al_reactor_current (r->server) == r)
+      return 1;
+   if (AL_ATOMIC_EXCHANGE (&(r->signalled), 1))
+      return 1;
+
+   /* signal! */
+#ifdef HAVE_SYS_EVENTFD_H
+   if (AL_ATOMIC_LOAD (&(r->state)) & AL_REACTOR_STATE_EVENTFD) {
+      uint64_t one = 1;
+      if (write (r->wake_fd[1], &one, sizeof (one)) == sizeof (one))
+         return 1;
+   }
+   else
+#endif
+   if (write (r->wake_fd[1], "\x01", 1) == 1)
+      return 1;
+
+   AL_PRINTF ("al_reactor_interrupt() failed.\n");
+   AL_ATOMIC_STORE (&(r->signalled), 0);
+   return 0;
+}
+
+/* al_reactor_current():
+ * ---------------------
+ * Return value: The reactor of 'server' running in this thread, or NULL if
+ *               this isn't one of the server's reactor threads.
+ */
+al_reactor_t *al_reactor_current (const al_server_t *server)
+{
+   al_reactor_t *r;
+   pthread_once (&al_reactor_key_once, al_reactor_key_init);
+   r = pthread_getspecific (al_reactor_key);
+   return (r && r->server == server) ? r : NULL;
+}
+
+/* al_reactor_write():
+ * al_reactor_write_buffer():
+ * --------------------------
+ * Writes data to all connections owned by a reactor.  Buffers are shared by
+ * every connection rather than copied.  Broadcasts posted to other
+ * reactors are counted before they're written, so output watermarks don't
+ * apply here either.
+ *
+ * Return value: The number of connections written to.
+ */
+int al_reactor_write (al_reactor_t *r, const unsigned char *buf,
+   size_t size)
+{
+   al_buffer_t *b;
+   int count;
+
+   if (buf == NULL || size == 0)
+      return 0;
+   b = al_buffer_new (size);
+   memcpy (b->data, buf, size);
+   b->len = size;
+   count = al_reactor_write_buffer (r, b);
+   al_buffer_unref (b);
+   return count;
+}
+
+int al_reactor_write_buffer (al_reactor_t *r, al_buffer_t *b)
+{
+   al_connection_t *c;
+   int count = 0;
+
+   al_reactor_lock (r);
+   for (c = r->connection_list; c != NULL; c = c->next)
+      count += al_reactor_loop_splice (c, b, 0, b->len);
+   al_reactor_unlock (r);
+   return count;
+}
+
+static int al_reactor_post_link (al_reactor_t *r, al_reactor_post_t *p)
+{
+   /* push onto the front of our list.  only our loop takes posts off of
+    * it, all at once, so nothing else ever changes what's already there. */
+   do
+      p->next = AL_ATOMIC_LOAD (&(r->post_list));
+   while (!AL_ATOMIC_CAS (&(r->post_list), p->next, p));
+
+   /* wake up the reactor. */
+   al_reactor_interrupt (r);
+   return 1;
+}
+
+/* al_reactor_post():
+ * al_reactor_post_buffer():
+ * -------------------------
+ * Hands data to a reactor to be used from its own thread.  This is how other
+ * threads reach connections they don't own without locking the reactor.
+ * al_reactor_post() makes a copy of 'buf'; al_reactor_post_buffer() takes a
+ * reference to 'b', which must not change afterwards.
+ *
+ * c:    Connection the data is for, or NULL for all of the reactor's
+ *       connections.
+ * type: What to do with the data:
+ *    AL_REACTOR_POST_WRITE:    Write it to the connection(s).
+ *    AL_REACTOR_POST_HOSTNAME: Assign it as the connection's hostname and
+ *                              run AL_SERVER_FUNC_HOSTNAME.
+ *
+ * Return value: 1 on success, 0 if there was nothing to post.
+ */
+int al_reactor_post (al_reactor_t *r, al_connection_t *c, int type,
+   const unsigned char *buf, size_t size)
+{
+   al_buffer_t *b;
+   int res;
+
+   if (buf == NULL || size == 0)
+      return 0;
+
+   /* copy our data. */
+   b = al_buffer_new (size);
+   memcpy (b->data, buf, size);
+   b->len = size;
+   res = al_reactor_post_buffer (r, c, type, b);
+   al_buffer_unref (b);
+   return res;
+}
+
+int al_reactor_post_buffer (al_reactor_t *r, al_connection_t *c, int type,
+   al_buffer_t *b)
+{
+   al_reactor_post_t *p;
+   if (b == NULL || b->len == 0)
+      return 0;
+
+   p = calloc (1, sizeof (al_reactor_post_t));
+   p->type       = type;
+   p->connection = c;
+   p->buffer     = al_buffer_ref (b);
+   return al_reactor_post_link (r, p);
+}
+
+/* al_reactor_post_splice():
+ * -------------------------
+ * Writes 'len' bytes of a buffer, starting at 'pos', to a connection from
+ * the reactor's own thread without copying them.  File buffers can be
+ * posted this way too.
+ *
+ * Return value: 1 on success, 0 if there was nothing to post.
+ */
+int al_reactor_post_splice (al_reactor_t *r, al_connection_t *c,
+   al_buffer_t *b, size_t pos, size_t len)
+{
+   al_reactor_post_t *p;
+   if (b == NULL || len == 0)
+      return 0;
+
+   p = calloc (1, sizeof (al_reactor_post_t));
+   p->type       = AL_REACTOR_POST_SPLICE;
+   p->connection = c;
+   p->buffer     = al_buffer_ref (b);
+   p->pos        = pos;
+   p->len        = len;
+   return al_reactor_post_link (r, p);
+}
+
+/* al_reactor_post_func():
+ * -----------------------
+ * Runs 'func' from a reactor's own thread, in order with everything else
+ * posted to it.  If 'c' is freed first, 'func' never runs.
+ *
+ * Function hook type definition (al_reactor_func):
+ * ------------------------------------------------
+ * AL_REACTOR_FUNC (foo)  <-- parameters are (reactor, connection, arg)
+ *
+ * Return value: 1 on success.
+ */
+int al_reactor_post_func (al_reactor_t *r, al_connection_t *c,
+   al_reactor_func *func, void *arg)
+{
+   al_reactor_post_t *p = calloc (1, sizeof (al_reactor_post_t));
+   p->type       = AL_REACTOR_POST_FUNC;
+   p->connection = c;
+   p->func       = func;
+   p->arg        = arg;
+   return al_reactor_post_link (r, p);
+}
+
+/* al_reactor_post_id():
+ * ---------------------
+ * Writes a buffer to a connection by its id from the reactor's own thread.
+ * Unlike al_reactor_post_buffer(), the connection may already be gone, in
+ * which case the write is dropped.
+ *
+ * Return value: 1 on success, 0 if there was nothing to post.
+ */
+int al_reactor_post_id (al_reactor_t *r, al_connection_id_t id,
+   al_buffer_t *b)
+{
+   al_reactor_post_t *p;
+   if (b == NULL || b->len == 0)
+      return 0;
+
+   p = calloc (1, sizeof (al_reactor_post_t));
+   p->type   = AL_REACTOR_POST_SUBMIT;
+   p->id     = id;
+   p->buffer = al_buffer_ref (b);
+   return al_reactor_post_link (r, p);
+}
+
+/* al_reactor_post_cancel():
+ * -------------------------
+ * Drops data posted to a connection.  Called when the connection is freed.
+ * Posts still waiting for our loop can't be unlinked while other threads
+ * push more, so they're marked as cancelled instead.
+ *
+ * Return value: The number of posts dropped.
+ */
+int al_reactor_post_cancel (al_reactor_t *r, al_connection_t *c)
+{
+   al_reactor_post_t *p, *prev, *next;
+   int count = 0;
+
+   /* our list is only taken by our loop, which runs with the reactor
+    * locked. */
+   al_reactor_lock (r);
+   for (prev = NULL, p = r->post_work; p != NULL; p = next) {
+      next = p->next;
+      if (p->connection != c) {
+         prev = p;
+         continue;
+      }
+      if (prev) prev->next   = next;
+      else      r->post_work = next;
+      if (p->buffer)
+         al_buffer_unref (p->buffer);
+      free (p);
+      count++;
+   }
+   for (p = AL_ATOMIC_LOAD (&(r->post_list)); p != NULL; p = p->next) {
+      if (p->connection != c)
+         continue;
+      if (p->buffer)
+         al_buffer_unref (p->buffer);
+      p->type       = AL_REACTOR_POST_CANCELLED;
+      p->connection = NULL;
+      p->buffer     = NULL;
+      count++;
+   }
+   al_reactor_unlock (r);
+   return count;
+}
+
+/* al_reactor_id_new():
+ * --------------------
+ * Gives a connection a slot in our id table.  Called with the reactor
+ * locked.
+ *
+ * Return value: The connection's id, or AL_CONNECTION_ID_NONE if every slot
+ *               is taken.
+ */
+al_connection_id_t al_reactor_id_new (al_reactor_t *r, al_connection_t *c)
+{
+   al_reactor_slot_t *s;
+   int slot;
+
+   /* reuse a free slot, or add one to the end. */
+   if ((slot = r->slot_free) >= 0)
+      r->slot_free = r->slots[slot].next_free;
+   else {
+      if (r->slot_count >= AL_CONNECTION_ID_SLOTS)
+         return AL_CONNECTION_ID_NONE;
+      if (r->slot_count == r->slot_size) {
+         r->slot_size = r->slot_size ? r->slot_size * 2 : 64;
+         r->slots = realloc (r->slots,
+            sizeof (al_reactor_slot_t) * r->slot_size);
+      }
+      slot = r->slot_count++;
+      r->slots[slot].generation = 1;
+   }
+
+   s = r->slots + slot;
+   s->connection = c;
+   s->next_free  = -1;
+   return ((al_connection_id_t) s->generation << 32) |
+          ((al_connection_id_t) r->index << 24) | (al_connection_id_t) slot;
+}
+
+/* al_reactor_id_free():
+ * ---------------------
+ * Releases a connection's slot.  Its generation moves on, so anything still
+ * holding the old id won't find whatever takes the slot next.
+ */
+int al_reactor_id_free (al_reactor_t *r, al_connection_id_t id)
+{
+   al_reactor_slot_t *s;
+   int slot;
+
+   if (al_reactor_id_find (r, id) == NULL)
+      return 0;
+   slot = AL_CONNECTION_ID_SLOT (id);
+   s = r->slots + slot;
+   s->connection = NULL;
+   if (++s->generation == 0)
+      s->generation = 1;
+   s->next_free = r->slot_free;
+   r->slot_free = slot;
+   return 1;
+}
+
+/* al_reactor_id_find():
+ * ---------------------
+ * Return value: The connection with id 'id', or NULL if it's been freed or
+ *               doesn't belong to this reactor.
+ */
+al_connection_t *al_reactor_id_find (const al_reactor_t *r,
+   al_connection_id_t id)
+{
+   const al_reactor_slot_t *s;
+   int slot = AL_CONNECTION_ID_SLOT (id);
+
+   if (AL_CONNECTION_ID_REACTOR (id) != r->index || slot >= r->slot_count)
+      return NULL;
+   s = r->slots + slot;
+   if (s->generation != AL_CONNECTION_ID_GENERATION (id))
+      return NULL;
+   return s->connection;
+}
@@ -0,0 +1,285 @@
+/* resolve.c
+ * ---------
+ * background reverse DNS lookups with a cache of recent results. */
+
+/* getnameinfo() isn't available in strict C99. */
+#define _POSIX_C_SOURCE 200112L
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <stdlib.h>
+#include <string.h>
+#include <netdb.h>
+
+#include "alpaca/connections.h"
+#include "alpaca/reactor.h"
+#include "alpaca/timers.h"
+
+#include "alpaca/resolve.h"
+
+static void *al_resolver_pthread_func (void *arg);
+
+/* al_resolver_new():
+ * ------------------
+ * Creates a resolver and starts its thread.  Used by al_server_open() when
+ * AL_SERVER_RESOLVE_HOSTNAMES is set.
+ *
+ * Return value: A pointer to the new resolver, or NULL if its thread couldn't
+ *               be started.
+ */
+al_resolver_t *al_resolver_new (al_server_t *server)
+{
+   al_resolver_t *new;
+   int res;
+
+   new = calloc (1, sizeof (al_resolver_t));
+   new->server = server;
+   pthread_mutex_init (&(new->mutex), NULL);
+   pthread_cond_init (&(new->cond), NULL);
+
+   /* start resolving. */
+   if ((res = pthread_create (&(new->pthread), NULL, al_resolver_pthread_func,
+                              (void *) new)) != 0) {
+      AL_ERROR ("Unable to start resolver (Error: %d)\n", res);
+      pthread_cond_destroy (&(new->cond));
+      pthread_mutex_destroy (&(new->mutex));
+      free (new);
+      return NULL;
+   }
+   return new;
+}
+
+static void al_resolver_entry_free (al_resolver_t *res, al_resolve_entry_t *e)
+{
+   al_resolve_entry_t **h;
+
+   /* unlink from our hash bucket and our list. */
+   for (h = &(res->hash[e->addr.s_addr % AL_RESOLVE_HASH_SIZE]); *h != e;
+        h = &((*h)->hash_next));
+   *h = e->hash_next;
+   if (e->prev) e->prev->next   = e->next;
+   else         res->entry_list = e->next;
+   if (e->next) e->next->prev   = e->prev;
+   else         res->entry_last = e->prev;
+   res->entry_count--;
+
+   if (e->hostname)
+      free (e->hostname);
+   free (e);
+}
+
+/* al_resolver_free():
+ * -------------------
+ * Stops the resolver's thread, waiting for any lookup in progress, and frees
+ * all requests and cached results.  Connections should already be freed.
+ */
+int al_resolver_free (al_resolver_t *res)
+{
+   al_resolve_request_t *req;
+
+   /* tell our thread to quit and wait for it. */
+   pthread_mutex_lock (&(res->mutex));
+   res->state |= AL_RESOLVER_STATE_QUIT;
+   pthread_cond_signal (&(res->cond));
+   pthread_mutex_unlock (&(res->mutex));
+   pthread_join (res->pthread, NULL);
+
+   /* free everything else. */
+   while ((req = res->queue) != NULL) {
+      res->queue = req->next;
+      free (req);
+   }
+   while (res->entry_list)
+      al_resolver_entry_free (res, res->entry_list);
+   pthread_cond_destroy (&(res->cond));
+   pthread_mutex_destroy (&(res->mutex));
+   free (res);
+   return 1;
+}
+
+static al_resolve_entry_t *al_resolver_cache_get (al_resolver_t *res,
+   struct in_addr addr)
+{
+   al_resolve_entry_t *e;
+
+   for (e = res->hash[addr.s_addr % AL_RESOLVE_HASH_SIZE]; e != NULL;
+        e = e->hash_next)
+      if (e->addr.s_addr == addr.s_addr)
+         break;
+   if (e == NULL)
+      return NULL;
+
+   /* forget about old results. */
+   if (e->expires <= al_timer_clock ()) {
+      al_resolver_entry_free (res, e);
+      return NULL;
+   }
+
+   /* move to the front of our list. */
+   if (e->prev) {
+      e->prev->next = e->next;
+      if (e->next) e->next->prev   = e->prev;
+      else         res->entry_last = e->prev;
+      e->prev = NULL;
+      e->next = res->entry_list;
+      res->entry_list->prev = e;
+      res->entry_list = e;
+   }
+   return e;
+}
+
+static al_resolve_entry_t *al_resolver_cache_add (al_resolver_t *res,
+   struct in_addr addr, const char *hostname)
+{
+   al_resolve_entry_t *e;
+   int bucket = addr.s_addr % AL_RESOLVE_HASH_SIZE;
+
+   /* make room by dropping the least recently used result. */
+   if (res->entry_count >= AL_RESOLVE_CACHE_SIZE)
+      al_resolver_entry_free (res, res->entry_last);
+
+   /* add to the front of our list and our hash bucket. */
+   e = calloc (1, sizeof (al_resolve_entry_t));
+   e->addr     = addr;
+   e->hostname = hostname ? strdup (hostname) : NULL;
+   e->expires  = al_timer_clock () + (hostname ? AL_RESOLVE_CACHE_TTL :
+                                                  AL_RESOLVE_CACHE_TTL_FAIL);
+   e->hash_next = res->hash[bucket];
+   res->hash[bucket] = e;
+   e->next = res->entry_list;
+   if (e->next) e->next->prev   = e;
+   else         res->entry_last = e;
+   res->entry_list = e;
+   res->entry_count++;
+   return e;
+}
+
+/* al_resolver_request():
+ * ----------------------
+ * Looks up the hostname of a connection.  Cached results are assigned
+ * immediately.  Otherwise, the address is queued for our thread, and the
+ * hostname is assigned later from the connection's reactor, followed by
+ * AL_SERVER_FUNC_HOSTNAME.
+ *
+ * Return value: 1 if the hostname was cached, 0 if it was queued.
+ */
+int al_resolver_request (al_resolver_t *res, al_connection_t *c)
+{
+   al_resolve_request_t *req;
+   al_resolve_entry_t *e;
+
+   pthread_mutex_lock (&(res->mutex));
+   if ((e = al_resolver_cache_get (res, c->addr->sin_addr)) != NULL) {
+      if (e->hostname)
+         c->hostname = strdup (e->hostname);
+      pthread_mutex_unlock (&(res->mutex));
+      return 1;
+   }
+
+   /* queue our request at the back and wake up our thread. */
+   req = calloc (1, sizeof (al_resolve_request_t));
+   req->addr       = c->addr->sin_addr;
+   req->connection = c;
+   req->reactor    = c->reactor;
+   if (res->queue_last)
+      res->queue_last->next = req;
+   else
+      res->queue = req;
+   res->queue_last = req;
+   pthread_cond_signal (&(res->cond));
+   pthread_mutex_unlock (&(res->mutex));
+   return 0;
+}
+
+/* al_resolver_cancel():
+ * ---------------------
+ * Forgets about requests for a connection.  Called when the connection is
+ * freed.
+ *
+ * Return value: The number of requests cancelled.
+ */
+int al_resolver_cancel (al_resolver_t *res, al_connection_t *c)
+{
+   al_resolve_request_t *req, *prev, *next;
+   int count = 0;
+
+   pthread_mutex_lock (&(res->mutex));
+
+   /* the address being resolved now will still be cached. */
+   if (res->current && res->current->connection == c) {
+      res->current->connection = NULL;
+      count++;
+   }
+
+   /* drop anything still in our queue. */
+   for (prev = NULL, req = res->queue; req != NULL; req = next) {
+      next = req->next;
+      if (req->connection != c) {
+         prev = req;
+         continue;
+      }
+      if (prev) prev->next = next;
+      else      res->queue = next;
+      if (res->queue_last == req)
+         res->queue_last = prev;
+      free (req);
+      count++;
+   }
+
+   pthread_mutex_unlock (&(res->mutex));
+   return count;
+}
+
+/* al_resolver_pthread_func():
+ * ---------------------------
+ * Resolves queued addresses one at a time, caching the results and posting
+ * hostnames to the reactors of the connections that wanted them.
+ */
+static void *al_resolver_pthread_func (void *arg)
+{
+   al_resolver_t *res = arg;
+   al_resolve_request_t *req;
+   al_resolve_entry_t *e;
+   struct sockaddr_in addr;
+   char host[AL_RESOLVE_HOST_MAX];
+   int found;
+
+   pthread_mutex_lock (&(res->mutex));
+   while (1) {
+      /* wait for something to do. */
+      while (res->queue == NULL && !(res->state & AL_RESOLVER_STATE_QUIT))
+         pthread_cond_wait (&(res->cond), &(res->mutex));
+      if (res->state & AL_RESOLVER_STATE_QUIT)
+         break;
+
+      /* take the first request. */
+      req = res->queue;
+      if ((res->queue = req->next) == NULL)
+         res->queue_last = NULL;
+      res->current = req;
+
+      /* we might have resolved this address since it was queued.  if not,
+       * don't hold our lock while we're waiting on DNS. */
+      if ((e = al_resolver_cache_get (res, req->addr)) == NULL) {
+         pthread_mutex_unlock (&(res->mutex));
+         memset (&addr, 0, sizeof (addr));
+         addr.sin_family = AF_INET;
+         addr.sin_addr   = req->addr;
+         found = (getnameinfo ((struct sockaddr *) &addr, sizeof (addr),
+                               host, sizeof (host), NULL, 0,
+                               NI_NAMEREQD) == 0);
+         pthread_mutex_lock (&(res->mutex));
+         e = al_resolver_cache_add (res, req->addr, found ? host : NULL);
+      }
+
+      /* hand our result to the connection's reactor if it's still around. */
+      if (req->connection && e->hostname)
+         al_reactor_post (req->reactor, req->connection,
+            AL_REACTOR_POST_HOSTNAME, (unsigned char *) e->hostname,
+            strlen (e->hostname));
+      res->current = NULL;
+      free (req);
+   }
+   pthread_mutex_unlock (&(res->mutex));
+   return NULL;
+}
@@ -0,0 +1,283 @@
+/* route.c
+ * -------
+ * radix trie of URL paths for routing HTTP requests. */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "alpaca/http.h"
+
+#include "alpaca/route.h"
+
+static al_http_route_t *al_http_route_node_new (int type, const char *label,
+   size_t len)
+{
+   al_http_route_t *new = calloc (1, sizeof (al_http_route_t));
+   new->type      = type;
+   new->label     = malloc (len + 1);
+   new->label_len = len;
+   memcpy (new->label, label, len);
+   new->label[len] = '\0';
+   return new;
+}
+
+/* captures are only recognized at the start of a segment. */
+static int al_http_route_is_capture (const char *pattern, const char *p)
+{
+   return (*p == ':' || *p == '*') && p > pattern && p[-1] == '/';
+}
+
+static int al_http_route_check (const char *pattern)
+{
+   const char *p;
+   int count = 0;
+
+   if (pattern[0] != '/')
+      return 0;
+   for (p = pattern; *p != '\0'; p++) {
+      if (!al_http_route_is_capture (pattern, p))
+         continue;
+      count++;
+      /* parameters need names, and wildcards must come last. */
+      if (*p == ':' && (p[1] == '\0' || p[1] == '/'))
+         return 0;
+      if (*p == '*' && strchr (p, '/') != NULL)
+         return 0;
+   }
+   return count <= AL_HTTP_PARAMS_MAX;
+}
+
+static al_http_route_t *al_http_route_capture (al_http_route_t **node,
+   int type, const char *label, size_t len)
+{
+   /* every pattern capturing here must call it the same thing. */
+   if (*node == NULL)
+      *node = al_http_route_node_new (type, label, len);
+   else if ((*node)->label_len != len ||
+            memcmp ((*node)->label, label, len) != 0) {
+      AL_ERROR ("al_http_route_add(): capture '%s' conflicts with existing "
+                "capture '%s'.\n", label, (*node)->label);
+      return NULL;
+   }
+   return *node;
+}
+
+/* al_http_route_add():
+ * --------------------
+ * Routes requests for 'verb' whose path matches 'pattern' to 'func'.  Path
+ * segments starting with ':' capture a single segment, and a segment
+ * starting with '*' captures the rest of the path.  Captured values are
+ * available to 'func' through al_http_param_get().  For example, the
+ * pattern '/users/:id/files/' followed by '*path' captures 'id' and 'path'
+ * from '/users/42/files/docs/a.txt' as '42' and 'docs/a.txt'.
+ *
+ * When several routes match, static text wins over parameters, which win
+ * over wildcards.  Routes are tried before functions set for the whole verb
+ * with al_http_set_func().
+ *
+ * Return value: The trie node for our route, or NULL if the pattern is
+ *               invalid or its captures conflict with existing routes.
+ */
+al_http_route_t *al_http_route_add (al_http_t *http, const char *verb,
+   const char *pattern, al_http_func *func)
+{
+   al_http_route_t *n, *c, *split;
+   const char *p;
+   size_t len, i;
+
+   /* make sure our pattern makes sense before changing anything. */
+   if (!al_http_route_check (pattern)) {
+      AL_ERROR ("al_http_route_add(): invalid pattern '%s'.\n", pattern);
+      return NULL;
+   }
+
+   /* find (or create) the root for our verb. */
+   for (n = http->route_list; n != NULL; n = n->next)
+      if (strcmp (n->label, verb) == 0)
+         break;
+   if (n == NULL) {
+      n = al_http_route_node_new (AL_ROUTE_ROOT, verb, strlen (verb));
+      n->next = http->route_list;
+      http->route_list = n;
+   }
+
+   for (p = pattern; *p != '\0'; ) {
+      /* parameters capture up to the next '/'. */
+      if (*p == ':' && al_http_route_is_capture (pattern, p)) {
+         len = strcspn (p + 1, "/");
+         if ((n = al_http_route_capture (&(n->param), AL_ROUTE_PARAM, p + 1,
+                                         len)) == NULL)
+            return NULL;
+         p += len + 1;
+         continue;
+      }
+      /* wildcards capture everything else. */
+      if (*p == '*' && al_http_route_is_capture (pattern, p)) {
+         len = strlen (p + 1);
+         if ((n = al_http_route_capture (&(n->wildcard), AL_ROUTE_WILDCARD,
+                                         p + 1, len)) == NULL)
+            return NULL;
+         p += len + 1;
+         continue;
+      }
+
+      /* static text runs until the next capture. */
+      for (len = 1; p[len] != '\0'; len++)
+         if (al_http_route_is_capture (pattern, p + len))
+            break;
+
+      /* only one child can start with our first character.  if there's
+       * none, our text becomes a new one. */
+      for (c = n->children; c != NULL; c = c->next)
+         if (c->label[0] == p[0])
+            break;
+      if (c == NULL) {
+         c = al_http_route_node_new (AL_ROUTE_STATIC, p, len);
+         c->next = n->children;
+         n->children = c;
+         n = c;
+         p += len;
+         continue;
+      }
+
+      /* split the child if we only share the start of it. */
+      for (i = 0; i < len && i < c->label_len && c->label[i] == p[i]; i++);
+      if (i < c->label_len) {
+         split = al_http_route_node_new (AL_ROUTE_STATIC, c->label + i,
+            c->label_len - i);
+         split->def      = c->def;
+         split->children = c->children;
+         split->param    = c->param;
+         split->wildcard = c->wildcard;
+         c->def      = NULL;
+         c->children = split;
+         c->param    = NULL;
+         c->wildcard = NULL;
+         c->label[i]  = '\0';
+         c->label_len = i;
+      }
+      n = c;
+      p += i;
+   }
+
+   /* assign our function, replacing whatever was routed here before. */
+   if (n->def == NULL) {
+      n->def = calloc (1, sizeof (al_http_func_def_t));
+      n->def->http = http;
+      al_util_replace_string (&(n->def->verb), verb);
+   }
+   n->def->func = func;
+   return n;
+}
+
+static al_http_route_t *al_http_route_find (al_http_route_t *n,
+   al_http_state_t *state, const char *path, size_t len)
+{
+   al_http_route_t *c, *found;
+   al_http_param_t *param;
+   size_t seg;
+
+   if (len == 0 && n->def)
+      return n;
+
+   /* try static text first.  only one child can match our next
+    * character. */
+   for (c = (len > 0) ? n->children : NULL; c != NULL; c = c->next) {
+      if (c->label[0] != path[0])
+         continue;
+      if (c->label_len <= len && memcmp (c->label, path, c->label_len) == 0 &&
+          (found = al_http_route_find (c, state, path + c->label_len,
+                                       len - c->label_len)) != NULL)
+         return found;
+      break;
+   }
+
+   /* parameters take the rest of this segment. */
+   if (n->param && len > 0 && path[0] != '/') {
+      for (seg = 0; seg < len && path[seg] != '/'; seg++);
+      param = state->params + state->param_count++;
+      param->name  = n->param->label;
+      param->value = path;
+      param->len   = seg;
+      if ((found = al_http_route_find (n->param, state, path + seg,
+                                       len - seg)) != NULL)
+         return found;
+      state->param_count--;
+   }
+
+   /* wildcards take everything else. */
+   if (n->wildcard && n->wildcard->def) {
+      param = state->params + state->param_count++;
+      param->name  = n->wildcard->label;
+      param->value = path;
+      param->len   = len;
+      return n->wildcard;
+   }
+   return NULL;
+}
+
+/* al_http_route_match():
+ * ----------------------
+ * Finds the route for a request, recording captured parameters in 'state'.
+ * Lookups follow the path one character at a time, only stepping back to
+ * try a capture when static text led nowhere.
+ *
+ * Return value: The function definition of the matching route, or NULL if
+ *               there isn't one.
+ */
+al_http_func_def_t *al_http_route_match (const al_http_t *http,
+   al_http_state_t *state, const char *verb, const char *path)
+{
+   al_http_route_t *n, *found;
+
+   state->param_count = 0;
+   if (verb == NULL || path == NULL)
+      return NULL;
+   for (n = http->route_list; n != NULL; n = n->next)
+      if (strcmp (n->label, verb) == 0)
+         break;
+   if (n == NULL)
+      return NULL;
+   if ((found = al_http_route_find (n, state, path, strlen (path))) == NULL)
+      return NULL;
+   return found->def;
+}
+
+int al_http_route_free (al_http_route_t *r)
+{
+   al_http_route_t *c;
+
+   /* free everything below us. */
+   while ((c = r->children) != NULL) {
+      r->children = c->next;
+      al_http_route_free (c);
+   }
+   if (r->param)
+      al_http_route_free (r->param);
+   if (r->wildcard)
+      al_http_route_free (r->wildcard);
+
+   /* free our own data. */
+   if (r->def) {
+      free (r->def->verb);
+      free (r->def);
+   }
+   free (r->label);
+   free (r);
+   return 1;
+}
+
+/* al_http_param_get():
+ * --------------------
+ * Return value: A parameter captured by the route of the current request,
+ *               or NULL if there's none with this name.
+ */
+const al_http_param_t *al_http_param_get (const al_http_state_t *state,
+   const char *name)
+{
+   int i;
+   for (i = 0; i < state->param_count; i++)
+      if (strcmp (state->params[i].name, name) == 0)
+         return state->params + i;
+   return NULL;
+}
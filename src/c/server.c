@@ -2,7 +2,17 @@
  * --------
  * low-level server functions for AlPACA. */
 
+/* we need 'struct tcp_info' and strtok_r(). */
+#define _GNU_SOURCE
+
+#ifdef HAVE_CONFIG_H
+   #include "config.h"
+#endif
+
 #include <sys/ioctl.h>
+#ifdef HAVE_NETINET_TCP_H
+   #include <netinet/tcp.h>
+#endif
 #include <fcntl.h>
 #include <errno.h>
 #include <stdio.h>
@@ -11,10 +21,16 @@
 #include <unistd.h>
 #include <pthread.h>
 
+#include "alpaca/buffer.h"
 #include "alpaca/connections.h"
 #include "alpaca/modules.h"
 #include "alpaca/mutex.h"
+#include "alpaca/poll.h"
+#include "alpaca/reactor.h"
 #include "alpaca/read.h"
+#include "alpaca/resolve.h"
+#include "alpaca/timers.h"
+#include "alpaca/workers.h"
 
 #include "alpaca/server.h"
 
@@ -40,6 +56,18 @@ al_server_t *al_server_new (int port, al_flags_t flags)
    /* create a mutex for our running thread. */
    new->mutex = al_mutex_new ();
 
+   /* default accept() settings. */
+   new->backlog       = AL_SERVER_BACKLOG;
+   new->accept_budget = AL_SERVER_ACCEPT_BUDGET;
+   new->input_max     = AL_CONNECTION_INPUT_MAX;
+   new->output_high   = AL_CONNECTION_OUTPUT_HIGH;
+   new->output_low    = AL_CONNECTION_OUTPUT_LOW;
+
+   /* start with a single reactor sharing our mutex. */
+   new->reactor_count = 1;
+   new->reactors      = calloc (1, sizeof (al_reactor_t *));
+   new->reactors[0]   = al_reactor_new (new, 0, new->mutex);
+
    /* set port + flags. */
    al_server_set_flags (new, port, flags);
 
@@ -56,7 +84,11 @@ al_server_t *al_server_new (int port, al_flags_t flags)
  * server: Server whose flags are being modified
  * port:   Port used for listening (ex: 80 for HTTP)
  * flags:  Optional bit flags to enable certain features or modify behavior.
- *    (no flags yet)
+ *    AL_SERVER_RESOLVE_HOSTNAMES: Look up the hostname of every connection
+ *                          in a background thread.  Results arrive via
+ *                          AL_SERVER_FUNC_HOSTNAME.
+ *    AL_SERVER_USE_SELECT: Use select() instead of epoll for waiting on
+ *                          connections.  Limited to FD_SETSIZE descriptors.
  */
 int al_server_set_flags (al_server_t *server, int port, al_flags_t flags)
 {
@@ -74,21 +106,203 @@ int al_server_set_flags (al_server_t *server, int port, al_flags_t flags)
    return 1;
 }
 
+/* al_server_set_reactors():
+ * --------------------------
+ * Sets the number of reactors, each running the server loop in its own
+ * thread with its own listening socket, poller, and connections.  New
+ * connections are balanced between reactors by the kernel.  Can only be
+ * changed while the server is closed.
+ *
+ * server: Server whose reactors are being replaced.
+ * count:  Number of reactors, up to AL_SERVER_REACTORS_MAX.  If zero or
+ *         less, one reactor per core is used.
+ *
+ * Return value: 1 on success, 0 if the server is open.
+ */
+int al_server_set_reactors (al_server_t *server, int count)
+{
+   int i;
+
+   /* one reactor per core by default.  connection ids only have room for
+    * so many reactors. */
+   if (count <= 0) {
+      long cores = sysconf (_SC_NPROCESSORS_ONLN);
+      count = (cores > 0) ? (int) cores : 1;
+   }
+   count = AL_MIN (count, AL_SERVER_REACTORS_MAX);
+
+   /* don't allow reactors to be changed if the server is currently open. */
+   al_server_lock (server);
+   if (al_server_is_open (server)) {
+      al_server_unlock (server);
+      return 0;
+   }
+
+   /* replace our old reactors.  a single reactor shares our mutex, so
+    * locking the server is enough to lock its connections. */
+   while (server->reactor_count > 0)
+      al_reactor_free (server->reactors[--server->reactor_count]);
+   server->reactors = realloc (server->reactors,
+      sizeof (al_reactor_t *) * count);
+   for (i = 0; i < count; i++)
+      server->reactors[i] = al_reactor_new (server, i,
+         (count == 1) ? server->mutex : NULL);
+   server->reactor_count = count;
+
+   al_server_unlock (server);
+   return 1;
+}
+
+/* al_server_set_accept():
+ * ------------------------
+ * Sets how new connections are accepted.  Can only be changed while the
+ * server is closed.
+ *
+ * server:  Server whose settings are being modified.
+ * backlog: Length of the queue of connections waiting to be accepted
+ *          (passed to listen()).  The kernel may limit this further.
+ * budget:  Most connections a reactor accepts in one loop iteration before
+ *          it gets back to existing connections.
+ *
+ * Either value can be 0 to use the defaults, AL_SERVER_BACKLOG and
+ * AL_SERVER_ACCEPT_BUDGET.
+ *
+ * Return value: 1 on success, 0 if the server is open.
+ */
+int al_server_set_accept (al_server_t *server, int backlog, int budget)
+{
+   al_server_lock (server);
+   if (al_server_is_open (server)) {
+      al_server_unlock (server);
+      return 0;
+   }
+   server->backlog       = (backlog > 0) ? backlog : AL_SERVER_BACKLOG;
+   server->accept_budget = (budget  > 0) ? budget  : AL_SERVER_ACCEPT_BUDGET;
+   al_server_unlock (server);
+   return 1;
+}
+
+/* al_server_set_workers():
+ * ------------------------
+ * Sets the size of the pool of worker threads started along with the
+ * server, for work that shouldn't hold up the server loops (see
+ * al_workers_submit() and al_http_func_set_worker()).  Can only be changed
+ * while the server is closed.
+ *
+ * count:     Number of threads.  If zero, there's no pool.  If less than
+ *            zero, one thread per core is used.
+ * queue_max: Most jobs waiting for a thread, or 0 for AL_WORKERS_QUEUE_MAX.
+ *
+ * Return value: 1 on success, 0 if the server is open.
+ */
+int al_server_set_workers (al_server_t *server, int count, int queue_max)
+{
+   if (count < 0) {
+      long cores = sysconf (_SC_NPROCESSORS_ONLN);
+      count = (cores > 0) ? (int) cores : 1;
+   }
+
+   al_server_lock (server);
+   if (al_server_is_open (server)) {
+      al_server_unlock (server);
+      return 0;
+   }
+   server->worker_count     = count;
+   server->worker_queue_max = (queue_max > 0) ? queue_max
+                                              : AL_WORKERS_QUEUE_MAX;
+   al_server_unlock (server);
+   return 1;
+}
+
+/* al_server_set_input_max():
+ * ---------------------------
+ * Sets the most input a new connection holds on to before it's been used,
+ * bounding the memory a slow or stalled client can make us spend.  Once a
+ * connection reaches it, AL_SERVER_FUNC_INPUT_FULL decides whether it's
+ * closed.  Connections already open keep their limit (see
+ * al_connection_set_input_max()).
+ *
+ * max: Number of bytes, or 0 for no limit.  The default is
+ *      AL_CONNECTION_INPUT_MAX.
+ *
+ * Return value: 1 on success.
+ */
+int al_server_set_input_max (al_server_t *server, size_t max)
+{
+   al_server_lock (server);
+   server->input_max = max;
+   al_server_unlock (server);
+   return 1;
+}
+
+/* al_server_set_output_watermarks():
+ * ----------------------------------
+ * Sets the output watermarks for new connections.  Once 'high' bytes are
+ * queued for a connection, al_connection_write() and
+ * al_connection_write_buffer() refuse more with AL_CONNECTION_WOULD_BLOCK,
+ * and AL_SERVER_FUNC_WRITABLE runs once it's down to 'low'.  Writes handed
+ * over from other threads, broadcasts and al_connection_write_queue() are
+ * always queued, since they can't be refused.  Connections already open
+ * keep theirs (see al_connection_set_output_watermarks()).
+ *
+ * high: Number of bytes, or 0 for no limit (the default,
+ *       AL_CONNECTION_OUTPUT_HIGH).
+ * low:  Number of bytes, below 'high'.  The default is
+ *       AL_CONNECTION_OUTPUT_LOW.
+ *
+ * Return value: 1 on success, 0 if 'low' isn't below 'high'.
+ */
+int al_server_set_output_watermarks (al_server_t *server, size_t high,
+   size_t low)
+{
+   if (high > 0 && low >= high)
+      return 0;
+   al_server_lock (server);
+   server->output_high = high;
+   server->output_low  = low;
+   al_server_unlock (server);
+   return 1;
+}
+
+/* al_server_set_output_budget():
+ * ------------------------------
+ * Sets the most output all of our connections can have queued before we
+ * stop reading from those with more than their high watermark queued (or
+ * their low watermark, if they have no high one).  A client that keeps
+ * sending requests without reading our replies would otherwise make us
+ * queue them without limit.  Paused connections read again once their
+ * output is down to their low watermark.
+ *
+ * budget: Number of bytes, or 0 for no limit (the default).
+ *
+ * Return value: 1 on success.
+ */
+int al_server_set_output_budget (al_server_t *server, size_t budget)
+{
+   AL_ATOMIC_STORE (&(server->output_budget), budget);
+   return 1;
+}
+
 /* al_server_is_open():      (checks AL_SERVER_STATE_OPEN)
  * al_server_is_running():   (checks AL_SERVER_STATE_RUNNING)
  * al_server_is_quitting():  (checks AL_SERVER_STATE_QUITTING)
- * al_server_is_in_loop():   (checks AL_SERVER_STATE_IN_LOOP)
+ * al_server_is_in_loop():   (checks AL_REACTOR_STATE_IN_LOOP for the
+ *                            reactor running in this thread)
  * -------------------------------------------------------------
  * Return value: 1 if the flag checked is on, otherwise 0.
  */
 int al_server_is_open (const al_server_t *server)
-   { return (server->state & AL_SERVER_STATE_OPEN) ? 1 : 0; }
+   { return (AL_ATOMIC_LOAD (&(server->state)) & AL_SERVER_STATE_OPEN) ? 1 : 0; }
 int al_server_is_running (const al_server_t *server)
-   { return (server->state & AL_SERVER_STATE_RUNNING) ? 1 : 0; }
+   { return (AL_ATOMIC_LOAD (&(server->state)) & AL_SERVER_STATE_RUNNING) ? 1 : 0; }
 int al_server_is_quitting (const al_server_t *server)
-   { return (server->state & AL_SERVER_STATE_QUIT) ? 1 : 0; }
+   { return (AL_ATOMIC_LOAD (&(server->state)) & AL_SERVER_STATE_QUIT) ? 1 : 0; }
 int al_server_is_in_loop (const al_server_t *server)
-   { return (server->state & AL_SERVER_STATE_IN_LOOP) ? 1 : 0; }
+{
+   al_reactor_t *r = al_reactor_current (server);
+   return (r && (AL_ATOMIC_LOAD (&(r->state)) & AL_REACTOR_STATE_IN_LOOP))
+      ? 1 : 0;
+}
 
 /* al_server_lock():
  * -----------------
@@ -101,7 +315,7 @@ int al_server_lock (al_server_t *server)
    /* lock the mutex and return 0 if there was an error. */
    if (al_mutex_lock (server->mutex) != 0)
       return 0;
-   server->mutex_count++;
+   AL_ATOMIC_ADD (&(server->mutex_count), 1);
    return 1;
 }
 
@@ -118,20 +332,22 @@ int al_server_unlock (al_server_t *server)
    /* unlock the mutex and return 0 if there was an error. */
    if (al_mutex_unlock (server->mutex) != 0)
       return 0;
-   server->mutex_count--;
+   AL_ATOMIC_SUB (&(server->mutex_count), 1);
    return 1;
 }
 
 /* al_server_close():
  * ------------------
- * Closes all the server's connections, the pipe, and the listening socket.
- * If the thread for the server loop is running, it is closed before
+ * Closes all the server's connections, pipes, and listening sockets.
+ * If the threads for the server loop are running, they are closed before
  * proceeding.  This function cannot be called from within the server loop.
  *
  * Returns 1 if all sockets have been closed, 0 if the server wasn't open.
  */
 int al_server_close (al_server_t *server)
 {
+   int i;
+
    /* although this can be run from the *thread*, it can't be run from
     * inside the server *loop*, which relies on the server being open. */
    if (al_server_is_in_loop (server)) {
@@ -144,7 +360,7 @@ int al_server_close (al_server_t *server)
       return 0;
 
    /* the server shouldn't be running, but if it is, close it and wait
-    * patiently for the thread to die. */
+    * patiently for the threads to die. */
    if (al_server_is_running (server)) {
       al_server_stop (server);
       al_server_wait (server);
@@ -153,48 +369,49 @@ int al_server_close (al_server_t *server)
    /* lock the server while we're manipulating its state. */
    al_server_lock (server);
 
-   /* close connections. */
-   while (server->connection_list)
-      al_connection_free (server->connection_list);
+   /* close every reactor.  reactors sharing a socket don't own it, so
+    * the first reactor always closes last. */
+   for (i = server->reactor_count - 1; i >= 0; i--)
+      al_reactor_close (server->reactors[i]);
 
-   /* close socket. */
-   socket_close (server->sock_fd);
+   /* stop looking up hostnames. */
+   if (server->resolver) {
+      al_resolver_free (server->resolver);
+      server->resolver = NULL;
+   }
 
-   /* close our pipe. */
-   if (server->state & AL_SERVER_STATE_PIPE) {
-      server->state &= ~AL_SERVER_STATE_PIPE;
-      close (server->pipe_fd[0]);
-      close (server->pipe_fd[1]);
+   /* finish whatever our workers have left.  our connections are gone, so
+    * their results go nowhere. */
+   if (server->workers) {
+      al_workers_free (server->workers);
+      server->workers = NULL;
    }
 
    /* indicate that the server is no longer open. */
-   server->state &= ~AL_SERVER_STATE_OPEN;
+   AL_ATOMIC_AND (&(server->state), ~AL_SERVER_STATE_OPEN);
 
    /* relinquish control and return success. */
    al_server_unlock (server);
    return 1;
 }
 
-/* al_server_open():
- * -----------------
- * Opens a port for listening and accepting incoming connections.  This
- * function also creates a pipe used for interrupting the thread containing
- * the server loop.
+/* al_server_open_socket():
+ * ------------------------
+ * Opens a non-blocking TCP/IP socket listening on the server's port.
  *
- * Return value: 1 on success, 0 on failure of any kind.
+ * reuse_port: If non-zero, attempt to set SO_REUSEPORT so other sockets can
+ *             listen on the same port.  Set to 0 if that wasn't possible.
+ *
+ * Return value: The new socket, or -1 on failure.
  */
-int al_server_open (al_server_t *server)
+static int al_server_open_socket (al_server_t *server, int *reuse_port)
 {
-   int fd, flags, i, optval;
-
-   /* don't do anything if the server is currently open. */
-   if (al_server_is_open (server))
-      return 0;
+   int fd, flags, optval;
 
    /* attempt to get a TCP/IP socket. */
    if ((fd = socket (AF_INET, SOCK_STREAM, 0)) == SOCKET_ERROR) {
       AL_ERROR ("Unable to open socket (Error %d).\n", SOCKET_ERRNO);
-      return 0;
+      return -1;
    }
 
    /* let this be reusable.  this lets the server reclaim control of this
@@ -204,11 +421,17 @@ int al_server_open (al_server_t *server)
    optval = 1;
    setsockopt (fd, SOL_SOCKET, SO_REUSEADDR, &optval, sizeof (optval));
 
-   /* set up parameters for bind(). */
-   memset (&(server->addr), 0, sizeof (struct sockaddr_in));
-   server->addr.sin_family      = AF_INET;
-   server->addr.sin_addr.s_addr = INADDR_ANY;
-   server->addr.sin_port        = htons (server->port);
+   /* let every reactor have its own socket on the same port.  the kernel
+    * will balance incoming connections between them. */
+   if (*reuse_port) {
+#ifdef SO_REUSEPORT
+      if (setsockopt (fd, SOL_SOCKET, SO_REUSEPORT, &optval,
+                      sizeof (optval)) != 0)
+         *reuse_port = 0;
+#else
+      *reuse_port = 0;
+#endif
+   }
 
    /* bind the socket to a port on the server. */
    if (bind (fd, (struct sockaddr *) &(server->addr),
@@ -216,288 +439,96 @@ int al_server_open (al_server_t *server)
       AL_ERROR ("Unable to bind TCP/IP socket to port %d (Error %d).\n",
                 server->port, SOCKET_ERRNO);
       socket_close (fd);
-      return 0;
+      return -1;
    }
 
    /* listen for new connections. */
-   if (listen (fd, 5) < 0) {
+   if (listen (fd, server->backlog) < 0) {
       AL_ERROR ("Unable to listen() on port %d (Error %d).\n",
                 server->port, SOCKET_ERRNO);
       socket_close (fd);
-      return 0;
+      return -1;
    }
 
-   /* attempt to create a pipe we can use for select() interrupts.
-    * we use this pipe to "wake up" the server thread for events like
-    * shutting down, forcing output to be queued, and anything else that
-    * needs select() to stop waiting. */
-   memset (server->pipe_fd, 0, sizeof (int) * 2);
-   if (pipe (server->pipe_fd) != 0) {
-      AL_ERROR ("Warning: Unable to create pipe (Error %d). \n"
-                "Continuing anyway.\n", errno);
-   }
-   /* pipe() worked - set some things up. */
-   else {
-      /* make both ends of the pipe non-blocking so the pipe is never
-       * something being waited upon. */
-      for (i = 0; i < 2; i++) {
-         flags = fcntl (server->pipe_fd[i], F_GETFL);
-         flags |= O_NONBLOCK;
-         fcntl (server->pipe_fd[i], F_SETFL, flags);
-      }
-
-      /* remember that we have a pipe. */
-      server->state |= AL_SERVER_STATE_PIPE;
-   }
-
-   /* record our listening socket and mark that our server is now open. */
-   server->sock_fd = fd;
-   server->state |= AL_SERVER_STATE_OPEN;
+   /* reactors sharing a socket race for new connections, so make sure
+    * the losers don't block in accept(). */
+   flags = fcntl (fd, F_GETFL);
+   flags |= O_NONBLOCK;
+   fcntl (fd, F_SETFL, flags);
 
-   /* return success. */
-   return 1;
+   return fd;
 }
 
-/* al_server_loop_func():
- * ----------------------
- * This function is called from the server loop in al_server_pthread_func().
- * It does several important things:
- *
- *    1) Stage data to be sent out to connections,
- *    2) Use select() to wait until connections are ready for I/O,
- *    3) Read from connections with pending input and run function hooks,
- *    4) Write staged output to connections ready for output.
+/* al_server_open():
+ * -----------------
+ * Opens a port for listening and accepting incoming connections, and
+ * prepares every reactor for running its loop.  With more than one reactor,
+ * each gets its own SO_REUSEPORT socket if possible; otherwise, they share
+ * a single listening socket.
  *
  * Return value: 1 on success, 0 on failure of any kind.
  */
-int al_server_loop_func (al_server_t *server)
+int al_server_open (al_server_t *server)
 {
-   al_connection_t *c, *c_next;
-   struct sockaddr_in client_addr;
-   socklen_t client_addr_size;
-   int fd, fd_max, res, bytes_read;
-
-   /* before we wait, make sure our data is sane. */
-   al_server_lock (server);
-   server->state |= AL_SERVER_STATE_IN_LOOP;
-
-   /* some silly preparations for accept(). */
-   client_addr_size = sizeof (struct sockaddr_in);
-
-   /* zero-out our descriptor sets for select(). */
-   FD_ZERO (&(server->fd_in));
-   FD_ZERO (&(server->fd_out));
-   FD_ZERO (&(server->fd_other));
-
-   /* add our listening server. */
-   FD_SET (server->sock_fd, &(server->fd_in));
-   fd_max = server->sock_fd;
-
-   /* do we have a pipe?  read from it. */
-   if (server->state & AL_SERVER_STATE_PIPE) {
-      FD_SET (server->pipe_fd[0], &(server->fd_in));
-      fd_max = AL_MAX (fd_max, server->pipe_fd[0]);
-   }
-
-   /* add all other connections. */
-   struct timeval delay, now, *delay_ptr = NULL;
-   for (c = server->connection_list; c != NULL; c = c->next) {
-      /* unless we're closing, read from this. */
-      if (c->fd_in >= 0 && !(c->flags & AL_CONNECTION_CLOSING)) {
-         FD_SET (c->fd_in, &(server->fd_in));
-         FD_SET (c->fd_in, &(server->fd_other));
-         fd_max = AL_MAX (fd_max, c->fd_in);
-      }
+   int fd, i, reuse_port;
 
-      /* if there's stuff to write, add to the write buffer. */
-      if (c->fd_out >= 0) {
-         al_connection_stage_output (c);
-         if (c->flags & AL_CONNECTION_WRITING) {
-            FD_SET (c->fd_out, &(server->fd_out));
-            FD_SET (c->fd_out, &(server->fd_other));
-            fd_max = AL_MAX (fd_max, c->fd_out);
-         }
-      }
-
-      /* is there a timeout? if so, get the lowest one. */
-      if (c->timeout.tv_usec > 0 && c->timeout.tv_sec > 0) {
-         if (delay_ptr == NULL || timercmp (&(c->timeout), delay_ptr, <)) {
-            delay_ptr = &delay;
-            delay.tv_sec  = c->timeout.tv_sec;
-            delay.tv_usec = c->timeout.tv_usec;
-         }
-      }
-   }
-
-   /* if there's a timeout time, subtract 'now' to get the value
-    * for select(). */
-   if (delay_ptr) {
-      gettimeofday (&now, NULL);
-      timersub (delay_ptr, &now, delay_ptr);
-      if (delay.tv_sec < 0) {
-         delay.tv_sec  = 0;
-         delay.tv_usec = 0;
-      }
-   }
-
-   /* don't greedily lock the server while select() is waiting. */
-   al_server_unlock (server);
-
-   /* wait forever until we have some activity. */
-   if ((res = select (fd_max + 1, &(server->fd_in), &(server->fd_out),
-               &(server->fd_other), delay_ptr)) == SOCKET_ERROR) {
-      if (errno != EINTR)
-         AL_ERROR ("select() error: %d\n", errno);
-      server->state |= AL_SERVER_STATE_QUIT;
-      server->state &= ~AL_SERVER_STATE_IN_LOOP;
+   /* don't do anything if the server is currently open. */
+   if (al_server_is_open (server))
       return 0;
-   }
 
-   /* lock our server. */
-   al_server_lock (server);
+   /* set up parameters for bind(). */
+   memset (&(server->addr), 0, sizeof (struct sockaddr_in));
+   server->addr.sin_family      = AF_INET;
+   server->addr.sin_addr.s_addr = INADDR_ANY;
+   server->addr.sin_port        = htons (server->port);
 
-   /* clear out data from our pipe. */
-   if (server->state & AL_SERVER_STATE_PIPE)
-      if (FD_ISSET (server->pipe_fd[0], &(server->fd_in))) {
-         unsigned char buf[256];
-         res = read (server->pipe_fd[0], buf, 256);
+   /* open a socket for every reactor, or share the first one. */
+   reuse_port = (server->reactor_count > 1) ? 1 : 0;
+   for (i = 0; i < server->reactor_count; i++) {
+      if (i == 0 || reuse_port) {
+         if ((fd = al_server_open_socket (server, &reuse_port)) < 0)
+            break;
+         al_reactor_open (server->reactors[i], fd, 1);
       }
-
-   /* check for incoming connections. */
-   if (FD_ISSET (server->sock_fd, &(server->fd_in))) {
-      memset (&client_addr, 0, sizeof (struct sockaddr_in));
-      if ((fd = accept (server->sock_fd, (struct sockaddr *) &client_addr,
-                        &client_addr_size)) < 0)
-         AL_ERROR ("accept() error: %d\n", errno);
       else
-         al_connection_new (server, fd, fd, &client_addr, client_addr_size, 0);
+         al_reactor_open (server->reactors[i], server->reactors[0]->sock_fd,
+            0);
    }
 
-   /* have any connections timed out? */
-   gettimeofday (&now, NULL);
-   for (c = server->connection_list; c != NULL; c = c_next) {
-      c_next = c->next;
-      if (c->timeout.tv_sec == 0 && c->timeout.tv_usec == 0)
-         continue;
-      if (timercmp (&(c->timeout), &now, <)) {
-         c->flags |= AL_CONNECTION_TIMED_OUT;
-         if (server->func[AL_SERVER_FUNC_TIMEOUT])
-            server->func[AL_SERVER_FUNC_TIMEOUT] (server, c,
-               AL_SERVER_FUNC_TIMEOUT, 0);
-         al_connection_free (c);
-      }
+   /* if anything went wrong, close what we've opened. */
+   if (i < server->reactor_count) {
+      while (--i >= 0)
+         al_reactor_close (server->reactors[i]);
+      return 0;
    }
 
-   /* check all of our connections for input. */
-   for (c = server->connection_list; c != NULL; c = c_next) {
-      c_next = c->next;
-
-      /* close connections with errors. */
-      if (FD_ISSET (c->fd_in,  &(server->fd_other)) ||
-          FD_ISSET (c->fd_out, &(server->fd_other))) {
-         al_connection_free (c);
-         continue;
-      }
-
-      /* can we input? */
-      if (FD_ISSET (c->fd_in, &(server->fd_in))) {
-         if ((bytes_read = al_connection_fd_read (c)) < 0) {
-            al_connection_free (c);
-            continue;
-         }
-         while (c->input_len > c->input_pos &&
-                server->func[AL_SERVER_FUNC_READ]) {
-            al_func_read_t data = {
-               .connection   = c,
-               .data         = c->input + c->input_pos,
-               .data_len     = c->input_len - c->input_pos,
-               .new_data     = c->input + c->input_len - bytes_read,
-               .new_data_len = bytes_read,
-               .bytes_used   = 0
-            };
-            server->func[AL_SERVER_FUNC_READ] (server, c,
-               AL_SERVER_FUNC_READ, &data);
-            if (data.bytes_used >= c->input_len - c->input_pos) {
-               c->input_len = 0;
-               c->input_pos = 0;
-            }
-            else if (data.bytes_used >= 1) {
-               c->input_pos += data.bytes_used;
-               bytes_read    = data.new_data_len;
-            }
-            else
-               break;
-         }
-      }
-   }
+   /* start looking up hostnames if we want them. */
+   if (server->flags & AL_SERVER_RESOLVE_HOSTNAMES)
+      server->resolver = al_resolver_new (server);
 
-   /* check all of our connections for output and check
-    * if they should be closed. */
-   for (c = server->connection_list; c != NULL; c = c_next) {
-      c_next = c->next;
-      if (FD_ISSET (c->fd_out, &(server->fd_out))) {
-         if (al_connection_fd_write (c) < 0) {
-            al_connection_free (c);
-            continue;
-         }
-      }
-      if (c->output_len == 0 && c->flags & AL_CONNECTION_CLOSING) {
-         al_connection_free (c);
-         continue;
-      }
-   }
+   /* start our workers, if we want them. */
+   if (server->worker_count > 0)
+      server->workers = al_workers_new (server, server->worker_count,
+         server->worker_queue_max);
 
-   /* unlock server and return success. */
-   server->state &= ~AL_SERVER_STATE_IN_LOOP;
-   al_server_unlock (server);
+   /* mark that our server is now open and return success. */
+   AL_ATOMIC_OR (&(server->state), AL_SERVER_STATE_OPEN);
    return 1;
 }
 
-/* al_server_pthread_func():
- * -------------------------
- * Function hook passed to our POSIX thread.  This function is the main server
- * loop, which will continuously manage connections via al_server_loop_func()
- * until given the shutdown notice via toggling AL_SERVER_QUIT in the server
- * state.  If the al_server_open() was called from al_server_start(), all
- * connections including the listening socket are closed.
- */
-void *al_server_pthread_func (void *arg)
-{
-   al_server_t *server;
-   server = arg;
-
-   /* run until the server is told to quit. */
-   while (!al_server_is_quitting (server))
-      al_server_loop_func (server);
-
-   /* perform clean up.  mark that we're no longer running. */
-   al_server_lock (server);
-   server->state &= ~AL_SERVER_STATE_RUNNING;
-
-   /* if our connection was opened from al_server_start(), make sure we close
-    * it here, too. */
-   if (server->flags & AL_SERVER_CLOSE_AFTER_STOP) {
-      al_server_close (server);
-      server->flags &= ~AL_SERVER_CLOSE_AFTER_STOP;
-   }
-   al_server_unlock (server);
-
-   /* we're done. */
-   return NULL;
-}
-
 /* al_server_start():
  * -----------------
- * Start the server loop in a background thread called the 'server thread'.
- * For convenience, if the listening socket has not yet been opened, open it
- * here and give the responsibility to close it to the server thread.
+ * Start the server loop in background threads called 'server threads', one
+ * per reactor.  For convenience, if the listening socket has not yet been
+ * opened, open it here, and it's closed again by al_server_wait() once the
+ * server threads have ended.
  *
  * Returns 1 on success, 0 if the server was already running or the listening
  * socket couldn't be opened.
  */
 int al_server_start (al_server_t *server)
 {
-   int res;
+   int i;
 
    /* don't do anything if the server is already running. */
    if (al_server_is_running (server))
@@ -510,12 +541,34 @@ int al_server_start (al_server_t *server)
       server->flags |= AL_SERVER_CLOSE_AFTER_STOP;
    }
 
-   /* attempt to start a pthread. */
-   server->state |= AL_SERVER_STATE_RUNNING;
-   if ((res = pthread_create (&(server->pthread), NULL, al_server_pthread_func,
-                              (void *) server)) != 0) {
-      server->state &= ~(AL_SERVER_STATE_RUNNING | AL_SERVER_CLOSE_AFTER_STOP);
-      AL_ERROR ("Unable to start server (Error: %d)\n", res);
+   /* attempt to start a pthread for every reactor.  they can't finish
+    * before we're done, because they need our lock to do so. */
+   al_server_lock (server);
+   AL_ATOMIC_AND (&(server->state), ~AL_SERVER_STATE_QUIT);
+   AL_ATOMIC_OR  (&(server->state), AL_SERVER_STATE_RUNNING);
+   server->reactors_running = 0;
+   for (i = 0; i < server->reactor_count; i++) {
+      if (!al_reactor_start (server->reactors[i]))
+         break;
+      server->reactors_running++;
+   }
+
+   /* if nothing started, we're not running at all. */
+   if (server->reactors_running == 0) {
+      AL_ATOMIC_AND (&(server->state), ~AL_SERVER_STATE_RUNNING);
+      al_server_unlock (server);
+      if (server->flags & AL_SERVER_CLOSE_AFTER_STOP) {
+         al_server_close (server);
+         server->flags &= ~AL_SERVER_CLOSE_AFTER_STOP;
+      }
+      return 0;
+   }
+   al_server_unlock (server);
+
+   /* if only some reactors started, stop the ones that did. */
+   if (i < server->reactor_count) {
+      al_server_stop (server);
+      al_server_wait (server);
       return 0;
    }
 
@@ -525,55 +578,61 @@ int al_server_start (al_server_t *server)
 
 /* al_server_wait():
  * ------------------
- * Wait patiently for the server loop's thread to end from a shutdown signal.
+ * Wait patiently for the server loop's threads to end from a shutdown signal.
+ * If the server was opened by al_server_start(), it's closed afterwards.
  *
  * Return value: Returns 1 if the server shut down normally,
  *               returns 0 if the server wasn't running or if we're currently
- *                  in the server thread (this is an error).
+ *                  in a server thread (this is an error).
  */
 int al_server_wait (al_server_t *server)
 {
+   al_reactor_t *r;
+   int i, joined;
+
    if (al_server_in_thread (server)) {
       AL_ERROR ("al_server_wait() called within server thread!\n");
       return 0;
    }
-   if (!al_server_is_running (server))
-      return 0;
-   pthread_join (server->pthread, NULL);
-   return 1;
+
+   /* join every thread we've started. */
+   for (i = 0, joined = 0; i < server->reactor_count; i++) {
+      r = server->reactors[i];
+      if (!(AL_ATOMIC_LOAD (&(r->state)) & AL_REACTOR_STATE_THREAD))
+         continue;
+      pthread_join (r->pthread, NULL);
+      AL_ATOMIC_AND (&(r->state), ~AL_REACTOR_STATE_THREAD);
+      joined++;
+   }
+
+   /* if our server was opened by al_server_start(), close it now that none
+    * of our reactors are running. */
+   if (joined > 0 && (server->flags & AL_SERVER_CLOSE_AFTER_STOP)) {
+      server->flags &= ~AL_SERVER_CLOSE_AFTER_STOP;
+      al_server_close (server);
+   }
+   return (joined > 0) ? 1 : 0;
 }
 
 /* al_server_interrupt():
  * ----------------------
- * Writes to the pipe created in al_server_open() in order to break out of
- * the select() call in al_server_loop_func().
+ * Interrupts every reactor waiting for activity in al_reactor_loop_func().
  *
  * Return value: Returns 1 on success, 0 on any failure.
  */
 int al_server_interrupt (al_server_t *server)
 {
-   /* must be running. */
-   if (!al_server_is_running (server))
-      return 0;
-
-   /* must have a pipe we can send something to. */
-   if (!(server->state & AL_SERVER_STATE_PIPE))
-      return 0;
-
-   /* write something! */
-   if (write (server->pipe_fd[1], "\x01", 1) != 1) {
-      AL_PRINTF ("server_interrupt() failed.\n");
-      return 0;
-   }
-
-   return 1;
+   int i, count;
+   for (i = 0, count = 0; i < server->reactor_count; i++)
+      count += al_reactor_interrupt (server->reactors[i]);
+   return (count > 0) ? 1 : 0;
 }
 
 /* al_server_stop():
  * -----------------
- * Sends a shutdown signal to the server loop thread by toggling the
- * AL_SERVER_STATE_QUIT flag and sending an interrupt to the select() function
- * in al_server_loop_func().
+ * Sends a shutdown signal to the server loop threads by toggling the
+ * AL_SERVER_STATE_QUIT flag and interrupting the poller in every reactor's
+ * al_reactor_loop_func().
  *
  * Return value: Returns 1 on success, 0 if the server is not running or
  *               already shutting down.
@@ -584,7 +643,7 @@ int al_server_stop (al_server_t *server)
       return 0;
    if (al_server_is_quitting (server))
       return 0;
-   server->state |= AL_SERVER_STATE_QUIT;
+   AL_ATOMIC_OR (&(server->state), AL_SERVER_STATE_QUIT);
    al_server_interrupt (server);
    return 1;
 }
@@ -603,16 +662,17 @@ int al_server_free (al_server_t *server)
    }
 
    /* stop our server. */
-   if (al_server_is_running (server)) {
-      al_server_stop (server);
-      al_server_wait (server);
-   }
+   al_server_stop (server);
+   al_server_wait (server);
 
    /* make sure it's closed, just in case. */
    if (al_server_is_open (server))
       al_server_close (server);
 
-   /* destroy our mutex. */
+   /* get rid of our reactors, then destroy our mutex. */
+   while (server->reactor_count > 0)
+      al_reactor_free (server->reactors[--server->reactor_count]);
+   free (server->reactors);
    if (server->mutex)
       al_mutex_free (server->mutex);
 
@@ -648,6 +708,10 @@ int al_server_free (al_server_t *server)
  * task:       Type of task calling the function hook.
  * arg:        Task-specific data.  Cast to relevant type before using.
  *
+ * With more than one reactor (see al_server_set_reactors()), hooks are called
+ * concurrently from every reactor's thread while holding only the lock of
+ * the reactor that owns 'connection'.
+ *
  * For convenience, a macro is provided to declare al_server_func's:
  * -----------------------------------------------------------------
  * AL_SERVER_FUNC (foo)  <-- parameters are (server, connection, func, arg)
@@ -680,6 +744,35 @@ int al_server_free (al_server_t *server)
  *    arg:          al_func_pre_write_t *
  *                  (see 'connections.h' for specification)
  *    Return value: (unused)
+ *
+ * AL_SERVER_FUNC_TIMEOUT:
+ *    A connection's timeout has expired.  It will be closed afterwards.
+ *    arg:          (unused)
+ *    Return value: (unused)
+ *
+ * AL_SERVER_FUNC_HOSTNAME:
+ *    A connection's hostname was resolved in the background and assigned to
+ *    'connection->hostname'.  Only used with AL_SERVER_RESOLVE_HOSTNAMES.
+ *    Cached hostnames are assigned before AL_SERVER_FUNC_JOIN instead.
+ *    arg:          const char * (the hostname)
+ *    Return value: (unused)
+ *
+ * AL_SERVER_FUNC_WRITABLE:
+ *    A connection's queued output has drained to its low watermark (see
+ *    al_server_set_output_watermarks()) after it asked with
+ *    al_connection_notify_writable() or had a write refused with
+ *    AL_CONNECTION_WOULD_BLOCK.
+ *    arg:          (unused)
+ *    Return value: (unused)
+ *
+ * AL_SERVER_FUNC_INPUT_FULL:
+ *    A connection's unused input has reached its limit (see
+ *    al_server_set_input_max()).
+ *    arg:          (unused)
+ *    Return value: 1 to keep reading, once the limit has been raised with
+ *                  al_connection_set_input_max(), or 0 to close the
+ *                  connection.  Connections are also closed when there's
+ *                  no function.
  */
 int al_server_func_set (al_server_t *server, int task, al_server_func *func)
 {
@@ -689,16 +782,19 @@ int al_server_func_set (al_server_t *server, int task, al_server_func *func)
    if (task < 0 || task >= AL_SERVER_FUNC_MAX)
       return 0;
 
-   /* safely set function and return success. */
-   al_server_lock (server);
-   server->func[task] = func;
-   al_server_unlock (server);
+   /* reactors read their hooks without locking, so swap it in whole. */
+   AL_ATOMIC_STORE (&(server->func[task]), func);
    return 1;
 }
 
 /* al_server_write():
- * ------------------
- * Writes data to all connections on a server.
+ * al_server_write_buffer():
+ * -------------------------
+ * Writes data to all connections on a server.  The data is copied once into
+ * a buffer shared by every connection, which is freed once the last of them
+ * has sent it.  al_server_write_buffer() shares a buffer prepared by the
+ * caller, which must not change afterwards.  Output watermarks don't apply
+ * (see al_reactor_write_buffer()).
  *
  * server: The server instance.
  * buf:    Data to send out as unsigned bytes.
@@ -709,15 +805,37 @@ int al_server_func_set (al_server_t *server, int task, al_server_func *func)
 int al_server_write (al_server_t *server, const unsigned char *buf,
    size_t size)
 {
-   al_connection_t *c;
+   al_buffer_t *b;
    int count;
 
-   /* connection_write() to everyone! */
-   al_server_lock (server);
-   count = 0;
-   for (c = server->connection_list; c != NULL; c = c->next)
-      count += al_connection_write (c, buf, size);
-   al_server_unlock (server);
+   if (buf == NULL || size == 0)
+      return 0;
+   b = al_buffer_new (size);
+   memcpy (b->data, buf, size);
+   b->len = size;
+   count = al_server_write_buffer (server, b);
+   al_buffer_unref (b);
+   return count;
+}
+
+int al_server_write_buffer (al_server_t *server, al_buffer_t *b)
+{
+   al_reactor_t *r, *self;
+   int i, count, running;
+
+   /* connection_write() to everyone!  once the loops are running, each
+    * reactor's connections are only walked by its own thread, so everyone
+    * else gets the buffer through their post queue. */
+   self    = al_reactor_current (server);
+   running = al_server_is_running (server);
+   count   = 0;
+   for (i = 0; i < server->reactor_count; i++) {
+      r = server->reactors[i];
+      if (r == self || !running)
+         count += al_reactor_write_buffer (r, b);
+      else if (al_reactor_post_buffer (r, NULL, AL_REACTOR_POST_WRITE, b))
+         count += AL_ATOMIC_LOAD (&(r->connection_count));
+   }
 
    /* return the number of connections written to. */
    return count;
@@ -738,6 +856,60 @@ int al_server_write_string (al_server_t *server, const char *string)
    return al_server_write (server, (unsigned char *) string, strlen (string));
 }
 
+/* al_server_submit():
+ * al_server_submit_buffer():
+ * --------------------------
+ * Writes data to a connection by its id ('c->id') from any thread, without
+ * locking or waiting for the connection's reactor.  The write is handed to
+ * the reactor and made from its own thread.  If the connection is freed
+ * first, the write is dropped.  al_server_submit_buffer() shares a buffer
+ * prepared by the caller, which must not change afterwards.
+ *
+ * Return value: 1 if the data was written or handed off, 0 if there was
+ *               nothing to write or 'id' is no longer valid, or
+ *               AL_CONNECTION_WOULD_BLOCK if it was written right away and
+ *               the connection's output is full.  Handed off writes are
+ *               always queued, whatever the connection's watermarks.
+ */
+int al_server_submit (al_server_t *server, al_connection_id_t id,
+   const unsigned char *buf, size_t size)
+{
+   al_buffer_t *b;
+   int res;
+
+   if (buf == NULL || size == 0)
+      return 0;
+   b = al_buffer_new (size);
+   memcpy (b->data, buf, size);
+   b->len = size;
+   res = al_server_submit_buffer (server, id, b);
+   al_buffer_unref (b);
+   return res;
+}
+
+int al_server_submit_buffer (al_server_t *server, al_connection_id_t id,
+   al_buffer_t *b)
+{
+   al_connection_t *c;
+   al_reactor_t *r;
+   int res;
+
+   if (id == AL_CONNECTION_ID_NONE ||
+       AL_CONNECTION_ID_REACTOR (id) >= server->reactor_count)
+      return 0;
+   r = server->reactors[AL_CONNECTION_ID_REACTOR (id)];
+
+   /* the reactor's own thread (or anyone, before the loops start) can write
+    * right away. */
+   if (al_reactor_current (server) != r && al_server_is_running (server))
+      return al_reactor_post_id (r, id, b);
+   al_reactor_lock (r);
+   c   = al_reactor_id_find (r, id);
+   res = c ? al_connection_write_buffer (c, b) : 0;
+   al_reactor_unlock (r);
+   return res;
+}
+
 /* al_server_module_new():
  * -----------------------
  * Simple server wrapper for al_module_new().  Assigns generic data to the
@@ -755,8 +927,8 @@ int al_server_write_string (al_server_t *server, const char *string)
 al_module_t *al_server_module_new (al_server_t *server, const char *name,
    void *data, size_t data_size, al_module_func *free_func)
 {
-   return al_module_new (server, &(server->module_list), name, data, data_size,
-                         free_func);
+   return al_module_new (server, &(server->module_list),
+      server->module_slots, name, data, data_size, free_func);
 }
 
 /* al_server_module_get():
@@ -768,20 +940,145 @@ al_module_t *al_server_module_get (const al_server_t *server,
    const char *name)
    { return al_module_get (&(server->module_list), name); }
 
+/* al_server_module_slot():
+ * ------------------------
+ * Looks up a module by the id registered for its name with
+ * al_module_register(), without searching.  Returns NULL if there isn't
+ * one.
+ */
+al_module_t *al_server_module_slot (const al_server_t *server, int id)
+{
+   return (id >= 0 && id < AL_MODULE_SLOTS) ? server->module_slots[id]
+                                            : NULL;
+}
+
+/* al_server_read_netstat():
+ * --------------------------
+ * Reads system-wide listen queue overflows and drops from /proc/net/netstat.
+ *
+ * Return value: 1 if they were found, 0 otherwise.
+ */
+static int al_server_read_netstat (unsigned long *overflows,
+   unsigned long *drops)
+{
+   char names[8192], values[8192], *n, *v, *n_save, *v_save;
+   int found = 0;
+   FILE *file;
+
+   if ((file = fopen ("/proc/net/netstat", "r")) == NULL)
+      return 0;
+
+   /* counters come in pairs of lines: names, then values. */
+   while (fgets (names, sizeof (names), file) &&
+          fgets (values, sizeof (values), file)) {
+      if (strncmp (names, "TcpExt:", 7) != 0)
+         continue;
+      n = strtok_r (names,  " \n", &n_save);
+      v = strtok_r (values, " \n", &v_save);
+      while ((n = strtok_r (NULL, " \n", &n_save)) &&
+             (v = strtok_r (NULL, " \n", &v_save))) {
+         if (strcmp (n, "ListenOverflows") == 0)
+            *overflows = strtoul (v, NULL, 10), found = 1;
+         else if (strcmp (n, "ListenDrops") == 0)
+            *drops = strtoul (v, NULL, 10), found = 1;
+      }
+      break;
+   }
+   fclose (file);
+   return found;
+}
+
+/* al_server_get_stats():
+ * ----------------------
+ * Gathers counters useful for tuning al_server_set_accept().  Accept counters
+ * are summed from every reactor.  Listen queue lengths come from TCP_INFO on
+ * each listening socket, and overflows come from /proc/net/netstat, so they
+ * are only available on Linux (and are system-wide).
+ *
+ * stats: Filled with our counters (see 'server.h').
+ *
+ * Return value: 1 on success.
+ */
+int al_server_get_stats (const al_server_t *server, al_server_stats_t *stats)
+{
+   al_reactor_t *r;
+   int i;
+
+   memset (stats, 0, sizeof (al_server_stats_t));
+   for (i = 0; i < server->reactor_count; i++) {
+      r = server->reactors[i];
+      stats->accepts            += r->accepts;
+      stats->accept_wakeups     += r->accept_wakeups;
+      stats->accept_budget_hits += r->accept_budget_hits;
+      stats->accept_max = AL_MAX (stats->accept_max, r->accept_max);
+      stats->input_bytes += AL_ATOMIC_LOAD (&(r->input_bytes));
+      stats->input_full  += AL_ATOMIC_LOAD (&(r->input_full));
+      stats->output_bytes += AL_ATOMIC_LOAD (&(r->output_bytes));
+      stats->read_pauses  += AL_ATOMIC_LOAD (&(r->read_pauses));
+
+      /* how many connections are waiting to be accepted? */
+#if defined(HAVE_NETINET_TCP_H) && defined(TCP_INFO)
+      if ((AL_ATOMIC_LOAD (&(r->state)) & AL_REACTOR_STATE_SOCKET) &&
+          r->sock_fd >= 0) {
+         struct tcp_info info;
+         socklen_t size = sizeof (info);
+         if (getsockopt (r->sock_fd, IPPROTO_TCP, TCP_INFO, &info,
+                         &size) == 0) {
+            stats->listen_queue     += info.tcpi_unacked;
+            stats->listen_queue_max += info.tcpi_sacked;
+         }
+      }
+#endif
+   }
+   al_server_read_netstat (&(stats->listen_overflows),
+                           &(stats->listen_drops));
+   return 1;
+}
+
+/* al_server_timer_set():
+ * ----------------------
+ * Sets a timer (see 'timers.c') to run after 'ms' milliseconds in the
+ * current reactor's thread, or in the first reactor's thread if called from
+ * elsewhere.  Timers set for a connection should use
+ * al_connection_timer_set() instead so they run alongside the connection.
+ *
+ * Return value: 1 on success.
+ */
+int al_server_timer_set (al_server_t *server, al_timer_t *timer,
+   unsigned long ms)
+{
+   al_reactor_t *r;
+
+   /* other threads use our first reactor and need to wake it up. */
+   if ((r = al_reactor_current (server)) != NULL)
+      return al_timer_set (r->timers, timer, ms);
+   r = server->reactors[0];
+   al_reactor_lock (r);
+   al_timer_set (r->timers, timer, ms);
+   al_reactor_interrupt (r);
+   al_reactor_unlock (r);
+   return 1;
+}
+
 /* al_server_in_thread():
  * ----------------------
- * Check if pthread_self() matches the server thread.
+ * Check if pthread_self() matches any of the server's reactor threads.
  *
- * server: The server whose thread we're checking.
+ * server: The server whose threads we're checking.
  *
- * Returns: 0 if the server is not running or pthread_self() doesn't match.
- *          1 if the server is running and pthread_self() matches.
+ * Returns: 0 if pthread_self() isn't one of the server's threads.
+ *          1 if pthread_self() is running one of the server's reactors.
  */
 int al_server_in_thread (const al_server_t *server)
+   { return al_reactor_current (server) ? 1 : 0; }
+
+/* al_server_reactor_index():
+ * --------------------------
+ * Returns: The index of the reactor running in this thread, or -1 if this
+ *          isn't one of the server's threads.
+ */
+int al_server_reactor_index (const al_server_t *server)
 {
-   if (!al_server_is_running (server))
-      return 0;
-   if (pthread_equal (pthread_self(), server->pthread))
-      return 1;
-   return 0;
+   al_reactor_t *r = al_reactor_current (server);
+   return r ? r->index : -1;
 }
@@ -0,0 +1,290 @@
+/* timers.c
+ * --------
+ * hierarchical timer wheels driven by a monotonic clock. */
+
+/* clock_gettime() isn't available in strict C99. */
+#define _POSIX_C_SOURCE 200112L
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/time.h>
+
+#ifdef HAVE_CONFIG_H
+   #include "config.h"
+#endif
+
+#include "alpaca/timers.h"
+
+/* al_timer_clock():
+ * -----------------
+ * Return value: Milliseconds from a monotonic clock with an arbitrary
+ *               starting point.  Falls back to the time of day if there's
+ *               no monotonic clock available.
+ */
+unsigned long long al_timer_clock (void)
+{
+#ifdef HAVE_CLOCK_GETTIME
+   struct timespec ts;
+   if (clock_gettime (CLOCK_MONOTONIC, &ts) == 0)
+      return (unsigned long long) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+#endif
+   struct timeval tv;
+   gettimeofday (&tv, NULL);
+   return (unsigned long long) tv.tv_sec * 1000 + tv.tv_usec / 1000;
+}
+
+al_timer_wheel_t *al_timer_wheel_new (void)
+{
+   al_timer_wheel_t *new = calloc (1, sizeof (al_timer_wheel_t));
+   new->now = al_timer_clock ();
+   return new;
+}
+
+static void al_timer_unlink (al_timer_t *t)
+{
+   if (t->prev) t->prev->next = t->next;
+   else         *(t->list)    = t->next;
+   if (t->next) t->next->prev = t->prev;
+   t->wheel->count--;
+   t->wheel = NULL;
+   t->list  = NULL;
+   t->prev  = NULL;
+   t->next  = NULL;
+}
+
+static void al_timer_link (al_timer_wheel_t *w, al_timer_t *t)
+{
+   unsigned long long delta, when;
+   al_timer_t **list;
+   int level;
+
+   /* timers that are already due run on the next tick. */
+   if (t->expires <= w->now)
+      list = &(w->slots[0][w->now & AL_TIMER_MASK]);
+   else {
+      /* find the lowest level whose slots can reach our expiration. */
+      delta = t->expires - w->now;
+      for (level = 0; level < AL_TIMER_LEVELS - 1; level++)
+         if (delta < (1ULL << (AL_TIMER_BITS * (level + 1))))
+            break;
+
+      /* timers past the last level go as far away as possible.  they'll be
+       * placed again when cascaded. */
+      when = t->expires;
+      if (delta >= (1ULL << (AL_TIMER_BITS * AL_TIMER_LEVELS)))
+         when = w->now + (1ULL << (AL_TIMER_BITS * AL_TIMER_LEVELS)) - 1;
+      list = &(w->slots[level][(when >> (AL_TIMER_BITS * level)) &
+                               AL_TIMER_MASK]);
+   }
+
+   /* link to the front of our slot. */
+   t->wheel = w;
+   t->list  = list;
+   t->prev  = NULL;
+   t->next  = *list;
+   if (t->next)
+      t->next->prev = t;
+   *list = t;
+   w->count++;
+}
+
+int al_timer_wheel_free (al_timer_wheel_t *w)
+{
+   int level, i;
+
+   /* timers still set belong to someone else - just forget about them. */
+   for (level = 0; level < AL_TIMER_LEVELS; level++)
+      for (i = 0; i < AL_TIMER_SLOTS; i++)
+         while (w->slots[level][i])
+            al_timer_unlink (w->slots[level][i]);
+   free (w);
+   return 1;
+}
+
+static int al_timer_cascade (al_timer_wheel_t *w, int level, int index)
+{
+   al_timer_t *t;
+
+   /* move every timer in this slot down to where it belongs now. */
+   while ((t = w->slots[level][index]) != NULL) {
+      al_timer_unlink (t);
+      al_timer_link (w, t);
+   }
+   return index;
+}
+
+/* al_timer_wheel_run():
+ * ---------------------
+ * Advances the wheel to the current time, running the function of every
+ * timer that has expired.  Only expired timers are visited; timers in higher
+ * levels are moved down once every 64 ticks of the level below.
+ *
+ * Return value: The number of timers that expired.
+ */
+int al_timer_wheel_run (al_timer_wheel_t *w)
+{
+   unsigned long long target;
+   al_timer_t *work, *t;
+   int count, index, level, i, ms;
+
+   target = al_timer_clock ();
+   count  = 0;
+   while (w->now <= target) {
+      /* nothing to do?  skip ahead. */
+      if (w->count == 0) {
+         w->now = target + 1;
+         break;
+      }
+
+      /* when the first level wraps around, bring down timers from the
+       * next slot of each level above. */
+      index = w->now & AL_TIMER_MASK;
+      if (index == 0) {
+         for (level = 1; level < AL_TIMER_LEVELS; level++)
+            if (al_timer_cascade (w, level, (w->now >> (AL_TIMER_BITS *
+                                  level)) & AL_TIMER_MASK) != 0)
+               break;
+      }
+      /* if there's nothing left in the first level before it wraps,
+       * skip right to the next cascade. */
+      else {
+         for (i = index; i < AL_TIMER_SLOTS; i++)
+            if (w->slots[0][i])
+               break;
+         if (i == AL_TIMER_SLOTS) {
+            w->now = AL_MIN ((w->now | AL_TIMER_MASK) + 1, target + 1);
+            continue;
+         }
+      }
+
+      /* take every timer due on this tick.  timers set from their own
+       * functions will run on a later tick. */
+      work = w->slots[0][index];
+      w->slots[0][index] = NULL;
+      for (t = work; t != NULL; t = t->next)
+         t->list = &work;
+      w->now++;
+
+      /* run them, setting them again if they ask us to. */
+      while ((t = work) != NULL) {
+         al_timer_unlink (t);
+         ms = t->func ? t->func (t, t->arg) : 0;
+         if (ms > 0)
+            al_timer_set (w, t, ms);
+         count++;
+      }
+   }
+   return count;
+}
+
+/* al_timer_wheel_next():
+ * ----------------------
+ * Return value: Milliseconds until the wheel should be run again, or -1 if
+ *               there are no timers set.  Timers in higher levels are
+ *               counted from when they'll be moved down, so this may be
+ *               sooner than the next timer actually expires.
+ */
+long al_timer_wheel_next (const al_timer_wheel_t *w)
+{
+   unsigned long long width, base, when, best, now;
+   int level, index, i, found;
+
+   if (w->count == 0)
+      return -1;
+
+   /* find the first occupied slot in every level. */
+   for (level = 0, found = 0, best = 0; level < AL_TIMER_LEVELS; level++) {
+      width = 1ULL << (AL_TIMER_BITS * level);
+      base  = (w->now + width - 1) & ~(width - 1);
+      index = (base >> (AL_TIMER_BITS * level)) & AL_TIMER_MASK;
+      for (i = 0; i < AL_TIMER_SLOTS; i++) {
+         if (w->slots[level][(index + i) & AL_TIMER_MASK] == NULL)
+            continue;
+         when = base + i * width;
+         if (!found || when < best)
+            best = when;
+         found = 1;
+         break;
+      }
+   }
+   if (!found)
+      return -1;
+
+   /* how long until then? */
+   now = al_timer_clock ();
+   return (best <= now) ? 0 : (long) (best - now);
+}
+
+/* al_timer_new():
+ * al_timer_init():
+ * ----------------
+ * Creates a new timer or prepares one embedded in another structure.  Timers
+ * do nothing until they're set with al_timer_set().
+ *
+ * func: Function called when the timer expires.
+ * arg:  Data passed to 'func'.
+ *
+ * Function hook type definition (al_timer_func):
+ * ----------------------------------------------
+ * AL_TIMER_FUNC (foo)  <-- parameters are (timer, arg)
+ *
+ * Return value: Milliseconds until the timer should run again, or 0 if it
+ *               shouldn't.  Timers freed from inside their function must
+ *               return 0.
+ */
+al_timer_t *al_timer_new (al_timer_func *func, void *arg)
+{
+   al_timer_t *new = malloc (sizeof (al_timer_t));
+   al_timer_init (new, func, arg);
+   return new;
+}
+
+int al_timer_init (al_timer_t *t, al_timer_func *func, void *arg)
+{
+   memset (t, 0, sizeof (al_timer_t));
+   t->func = func;
+   t->arg  = arg;
+   return 1;
+}
+
+int al_timer_free (al_timer_t *t)
+{
+   al_timer_cancel (t);
+   free (t);
+   return 1;
+}
+
+/* al_timer_set():
+ * ---------------
+ * Sets a timer to expire after 'ms' milliseconds.  Timers already set are
+ * moved.  Timers belong to the thread running their wheel; anyone else must
+ * lock the wheel's owner first.
+ *
+ * Return value: 1 on success.
+ */
+int al_timer_set (al_timer_wheel_t *w, al_timer_t *t, unsigned long ms)
+{
+   if (t->wheel)
+      al_timer_unlink (t);
+   t->expires = al_timer_clock () + ms;
+   al_timer_link (w, t);
+   return 1;
+}
+
+/* al_timer_cancel():
+ * ------------------
+ * Stops a timer from expiring.
+ *
+ * Return value: 1 on success, 0 if the timer wasn't set.
+ */
+int al_timer_cancel (al_timer_t *t)
+{
+   if (t->wheel == NULL)
+      return 0;
+   al_timer_unlink (t);
+   return 1;
+}
+
+int al_timer_is_active (const al_timer_t *t)
+   { return t->wheel ? 1 : 0; }
@@ -8,15 +8,47 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "alpaca/arena.h"
+
 #include "alpaca/uri.h"
 
+/* memory for URIs comes from their arena, if they have one. */
+static void *al_uri_calloc (const al_uri_t *uri, size_t size)
+{
+   return uri->arena ? al_arena_calloc (uri->arena, size) :
+                       calloc (1, size);
+}
+static char *al_uri_strndup (const al_uri_t *uri, const char *string,
+   size_t len)
+{
+   char *new;
+   if (uri->arena)
+      return al_arena_strndup (uri->arena, string, len);
+   new = malloc (len + 1);
+   memcpy (new, string, len);
+   new[len] = '\0';
+   return new;
+}
+static char *al_uri_strdup (const al_uri_t *uri, const char *string)
+   { return al_uri_strndup (uri, string, strlen (string)); }
+static void al_uri_release (const al_uri_t *uri, void *ptr)
+{
+   if (ptr && uri->arena == NULL)
+      free (ptr);
+}
+
 al_uri_t *al_uri_new (const char *string)
+   { return al_uri_new_arena (NULL, string); }
+
+al_uri_t *al_uri_new_arena (al_arena_t *arena, const char *string)
 {
    /* create a structure to contain our helpful URI data. */
-   al_uri_t *new = calloc (1, sizeof (al_uri_t));
+   al_uri_t *new = arena ? al_arena_calloc (arena, sizeof (al_uri_t)) :
+                           calloc (1, sizeof (al_uri_t));
+   new->arena = arena;
 
    /* set strings. */
-   new->str_full = strdup (string);
+   new->str_full = al_uri_strdup (new, string);
 
    /* is there a query? */
    char *q = strchr (string, '?');
@@ -25,20 +57,14 @@ al_uri_t *al_uri_new (const char *string)
 
       /* get the 'path' part (everything up until '?')... */
       len = (q - string);
-      new->str_path = malloc (sizeof (char) * (len + 1));
-      memcpy (new->str_path, string, len);
-      new->str_path[len] = '\0';
+      new->str_path = al_uri_strndup (new, string, len);
 
       /* ...and the 'query' part (everything after '?'). */
-      q++;
-      len = strlen (q);
-      new->str_query = malloc (sizeof (char) * (len + 1));
-      memcpy (new->str_query, q, len);
-      new->str_query[len] = '\0';
+      new->str_query = al_uri_strdup (new, q + 1);
    }
    /* no query - just copy the full thing. */
    else {
-      new->str_path  = strdup (string);
+      new->str_path  = al_uri_strdup (new, string);
       new->str_query = NULL;
    }
 
@@ -52,7 +78,7 @@ al_uri_t *al_uri_new (const char *string)
       al_uri_path_t *p = NULL;
 
       /* if the path doesn't start with '/', it's a relative path. */
-      str = strdup (new->str_path);
+      str = al_uri_strdup (new, new->str_path);
       pos = str;
       if (pos[0] == '/')
          pos++;
@@ -80,7 +106,7 @@ al_uri_t *al_uri_new (const char *string)
          /* append node to our path. */
          p = al_uri_path_append (new, p, decoded);
       }
-      free (str);
+      al_uri_release (new, str);
    }
 
    /* tokenize our query with either '&' or ';' as delimiters. */
@@ -105,7 +131,7 @@ int al_uri_parameter_build (al_uri_t *uri, const char *query,
    int rval = 1;
    const al_uri_parameter_t *p = NULL, *p_first = NULL;
 
-   char *str = strdup (query), *pos, *next;
+   char *str = al_uri_strdup (uri, query), *pos, *next;
    for (pos = str; pos != NULL; pos = next) {
       while (*pos == ' ')
          pos++;
@@ -135,7 +161,7 @@ int al_uri_parameter_build (al_uri_t *uri, const char *query,
       /* append the name+value pair to our parameter list. */
       p = al_uri_parameter_append (uri, &p_first, p, decoded_l, decoded_r);
    }
-   free (str);
+   al_uri_release (uri, str);
 
    /* store output variables and return our error code. */
    if (param_out)
@@ -145,6 +171,10 @@ int al_uri_parameter_build (al_uri_t *uri, const char *query,
 
 int al_uri_free (al_uri_t *uri)
 {
+   /* URIs in an arena are released with it. */
+   if (uri->arena)
+      return 1;
+
    /* free path nodes and parameters. */
    while (uri->path)
       al_uri_path_free (uri->path);
@@ -204,8 +234,8 @@ al_uri_path_t *al_uri_path_append (al_uri_t *uri, al_uri_path_t *prev,
    const char *name)
 {
    /* initialize a path node with a name. */
-   al_uri_path_t *new = calloc (1, sizeof (al_uri_path_t));
-   new->name = strdup (name);
+   al_uri_path_t *new = al_uri_calloc (uri, sizeof (al_uri_path_t));
+   new->name = al_uri_strdup (uri, name);
 
    /* link it. */
    new->uri = uri;
@@ -222,10 +252,10 @@ al_uri_path_t *al_uri_path_append (al_uri_t *uri, al_uri_path_t *prev,
 
 int al_uri_path_free (al_uri_path_t *path)
 {
-   if (path->name)
-      free (path->name);
+   al_uri_t *uri = path->uri;
+   al_uri_release (uri, path->name);
    AL_LL_UNLINK (path, prev, next, path->uri, path);
-   free (path);
+   al_uri_release (uri, path);
    return 1;
 }
 
@@ -236,14 +266,15 @@ const al_uri_parameter_t *al_uri_parameter_append (const al_uri_t *uri,
    /* replace old values with new ones. */
    al_uri_parameter_t *new;
    if ((new = (al_uri_parameter_t *) al_uri_parameter_get_real (list, name)) != NULL) {
-      al_util_replace_string (&(new->value), value);
+      al_uri_release (uri, new->value);
+      new->value = al_uri_strdup (uri, value);
       return new;
    }
 
    /* initialize a parameter with our name + value pair. */
-   new = calloc (1, sizeof (al_uri_parameter_t));
-   new->name  = strdup (name);
-   new->value = strdup (value);
+   new = al_uri_calloc (uri, sizeof (al_uri_parameter_t));
+   new->name  = al_uri_strdup (uri, name);
+   new->value = al_uri_strdup (uri, value);
 
    /* link it. */
    al_uri_parameter_t *prev_m = (al_uri_parameter_t *) prev;
@@ -276,17 +307,16 @@ const al_uri_parameter_t *al_uri_parameter_get (const al_uri_t *uri, const char
 
 int al_uri_parameter_free_real (al_uri_parameter_t *param, al_uri_parameter_t **list)
 {
-   if (param->name)
-      free (param->name);
-   if (param->value)
-      free (param->value);
+   al_uri_t *uri = param->uri;
+   al_uri_release (uri, param->name);
+   al_uri_release (uri, param->value);
    if (param->next)
       param->next->prev = param->prev;
    if (param->prev)
       param->prev->next = param->next;
    else
       *list = param->next;
-   free (param);
+   al_uri_release (uri, param);
    return 1;
 }
 int al_uri_parameter_free (al_uri_parameter_t *param)
@@ -0,0 +1,183 @@
+/* workers.c
+ * ---------
+ * pool of threads for running work off of the server loops. */
+
+#include <stdlib.h>
+
+#include "alpaca/workers.h"
+
+static void *al_workers_pthread_func (void *arg);
+
+/* al_workers_new():
+ * -----------------
+ * Creates a pool of threads and starts them.  Used by al_server_open() when
+ * workers were requested with al_server_set_workers().
+ *
+ * threads:   Number of threads.
+ * queue_max: Most jobs waiting for a thread before al_workers_submit()
+ *            refuses more.
+ *
+ * Return value: A pointer to the new pool, or NULL if no threads could be
+ *               started.
+ */
+al_workers_t *al_workers_new (al_server_t *server, int threads,
+   int queue_max)
+{
+   al_workers_t *new;
+   int i, res = 0;
+
+   new = calloc (1, sizeof (al_workers_t));
+   new->server    = server;
+   new->queue_max = queue_max;
+   new->busy      = calloc (threads, sizeof (const void *));
+   new->pthreads  = calloc (threads, sizeof (pthread_t));
+   pthread_mutex_init (&(new->mutex), NULL);
+   pthread_cond_init (&(new->cond), NULL);
+
+   /* start working.  make do with what we could start. */
+   for (i = 0; i < threads; i++) {
+      if ((res = pthread_create (new->pthreads + i, NULL,
+                                 al_workers_pthread_func, (void *) new)) != 0)
+         break;
+      new->thread_count++;
+   }
+   if (new->thread_count == 0) {
+      AL_ERROR ("Unable to start workers (Error: %d)\n", res);
+      al_workers_free (new);
+      return NULL;
+   }
+   return new;
+}
+
+/* al_workers_free():
+ * ------------------
+ * Stops the pool's threads once every job in the queue has been run, then
+ * frees the pool.
+ */
+int al_workers_free (al_workers_t *w)
+{
+   int i;
+
+   /* tell our threads to quit and wait for them. */
+   pthread_mutex_lock (&(w->mutex));
+   w->state |= AL_WORKERS_STATE_QUIT;
+   pthread_cond_broadcast (&(w->cond));
+   pthread_mutex_unlock (&(w->mutex));
+   for (i = 0; i < w->thread_count; i++)
+      pthread_join (w->pthreads[i], NULL);
+
+   pthread_cond_destroy (&(w->cond));
+   pthread_mutex_destroy (&(w->mutex));
+   free (w->pthreads);
+   free (w->busy);
+   free (w);
+   return 1;
+}
+
+/* al_workers_submit():
+ * --------------------
+ * Queues 'func' to be run with 'arg' on one of the pool's threads.  Jobs
+ * with the same non-NULL 'key' (a connection, for example) never run at the
+ * same time, and run in the order they were submitted.  Results go back to
+ * the server loops with al_reactor_post() or al_reactor_post_func().
+ *
+ * Function hook type definition (al_worker_func):
+ * -----------------------------------------------
+ * AL_WORKER_FUNC (foo)  <-- parameters are (workers, arg)
+ *
+ * Return value: 1 on success, 0 if the queue is full or the pool is
+ *               stopping.
+ */
+int al_workers_submit (al_workers_t *w, const void *key,
+   al_worker_func *func, void *arg)
+{
+   al_worker_job_t *job;
+
+   pthread_mutex_lock (&(w->mutex));
+   if (w->queue_count >= w->queue_max ||
+       (w->state & AL_WORKERS_STATE_QUIT)) {
+      pthread_mutex_unlock (&(w->mutex));
+      return 0;
+   }
+
+   /* queue our job at the back and wake up a thread. */
+   job = malloc (sizeof (al_worker_job_t));
+   job->key  = key;
+   job->func = func;
+   job->arg  = arg;
+   job->next = NULL;
+   if (w->queue_last)
+      w->queue_last->next = job;
+   else
+      w->queue = job;
+   w->queue_last = job;
+   w->queue_count++;
+   pthread_cond_signal (&(w->cond));
+   pthread_mutex_unlock (&(w->mutex));
+   return 1;
+}
+
+static int al_workers_busy (const al_workers_t *w, const void *key)
+{
+   int i;
+   for (i = 0; i < w->thread_count; i++)
+      if (w->busy[i] == key)
+         return 1;
+   return 0;
+}
+
+/* take the oldest job whose key isn't already being worked on. */
+static al_worker_job_t *al_workers_take (al_workers_t *w)
+{
+   al_worker_job_t *job, *prev;
+
+   for (prev = NULL, job = w->queue; job != NULL; prev = job, job = job->next)
+      if (job->key == NULL || !al_workers_busy (w, job->key))
+         break;
+   if (job == NULL)
+      return NULL;
+   if (prev) prev->next = job->next;
+   else      w->queue   = job->next;
+   if (w->queue_last == job)
+      w->queue_last = prev;
+   w->queue_count--;
+   return job;
+}
+
+/* al_workers_pthread_func():
+ * --------------------------
+ * Runs queued jobs until the pool is freed and the queue is empty.
+ */
+static void *al_workers_pthread_func (void *arg)
+{
+   al_workers_t *w = arg;
+   al_worker_job_t *job;
+   int slot;
+
+   pthread_mutex_lock (&(w->mutex));
+   while (1) {
+      if ((job = al_workers_take (w)) == NULL) {
+         if ((w->state & AL_WORKERS_STATE_QUIT) && w->queue == NULL)
+            break;
+         pthread_cond_wait (&(w->cond), &(w->mutex));
+         continue;
+      }
+
+      /* hold on to our key while we work.  there's always a free slot,
+       * since each thread only runs one job at a time. */
+      for (slot = 0; w->busy[slot] != NULL; slot++);
+      w->busy[slot] = job->key;
+      pthread_mutex_unlock (&(w->mutex));
+
+      job->func (w, job->arg);
+
+      /* jobs waiting on our key can run now. */
+      pthread_mutex_lock (&(w->mutex));
+      w->busy[slot] = NULL;
+      if (job->key && w->queue)
+         pthread_cond_broadcast (&(w->cond));
+      free (job);
+   }
+   pthread_mutex_unlock (&(w->mutex));
+   return NULL;
+}
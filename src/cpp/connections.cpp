@@ -4,6 +4,7 @@
 
 
 //#include <iostream>
+#include <cstring>
 #include "alpaca/connections.hpp"
 #include "alpaca/server.hpp"
 
@@ -11,6 +12,8 @@
 
 AlpacaConnection::AlpacaConnection(al_connection_t *connection) {
     this->connection = connection;
+    this->server     = connection->server;
+    this->id         = connection->id;
 }
 
 AlpacaConnection::~AlpacaConnection() {
@@ -22,6 +25,7 @@ int AlpacaConnection::disconnect() {
         return 1;
     
     this->connection = nullptr;
+    this->id         = AL_CONNECTION_ID_NONE;
     return 0;
 }
 
@@ -34,7 +38,10 @@ bool AlpacaConnection::operator==(const al_connection_t *rhs) {
 }
 
 int AlpacaConnection::writeString(const char *string) {
-    return al_connection_write_string(this->connection, string);
+    /* write by id, so this is safe from any thread, even after the
+     * connection has gone away. */
+    return al_server_submit(this->server, this->id,
+        (const unsigned char *) string, strlen(string));
 }
 
 al_flags_t AlpacaConnection::flags() {
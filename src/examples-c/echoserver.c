@@ -11,7 +11,7 @@ int example_broadcast (al_connection_t *connection, char quote, char *message)
 
    /* for every connection sitting at a prompt, create a new line. */
    al_connection_t *c;
-   for (c = connection->server->connection_list; c != NULL; c = c->next)
+   for (c = connection->reactor->connection_list; c != NULL; c = c->next)
       if (c != connection && !(c->flags & AL_CONNECTION_WROTE))
          al_connection_write_string (c, "\r\n");
 
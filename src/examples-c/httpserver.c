@@ -1,6 +1,10 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <pthread.h>
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <time.h>
 
 #include <alpaca/alpaca.h>
 
@@ -18,22 +22,114 @@ AL_HTTP_FUNC (example_http_error)
    return 0;
 }
 
-AL_HTTP_FUNC (example_http_get)
+AL_HTTP_FUNC (example_http_no_content)
 {
-   /* simulate an error if our URI is 'error'. */
-   if (al_uri_path_is (path, "error", NULL)) {
-      al_http_set_status_code (request, 200);
-      return example_http_error (request, func, data, path);
-   }
    /* return a no-content page, whose response code should be 204. */
-   else if (al_uri_path_is (path, "no_content", NULL)) {
-      al_http_set_status_code (request, 204);
-      return 0;
-   }
+   al_http_set_status_code (request, 204);
+   return 0;
+}
+
+AL_HTTP_FUNC (example_http_blank)
+{
    /* return a blank page (different from 'no_content'). */
-   else if (al_uri_path_is (path, "blank", NULL))
+   return 0;
+}
+
+AL_HTTP_FUNC (example_http_user)
+{
+   /* say hello to whoever is in our path. */
+   const al_http_param_t *id = al_http_param_get (request, "id");
+   al_http_header_response_set (request, "Content-Type", "text/html");
+   al_http_write_stringf (request,
+      "<!doctype html>\n"
+      "<html>\n"
+      "<body>\n"
+      "<h1>Hello, user %.*s!</h1>\n"
+      "</body>\n"
+      "</html>\n", (int) id->len, id->value);
+   return 0;
+}
+
+AL_HTTP_BODY_FUNC (example_http_upload_body)
+{
+   /* uploads stream through without being stored.  once it's over, say
+    * how much we got. */
+   if (data == NULL && request->status_code == 200)
+      al_http_write_stringf (request, "Received %lu bytes.\n",
+         (unsigned long) request->body_len);
+   return 1;
+}
+
+AL_HTTP_FUNC (example_http_upload)
+{
+   /* read our body as it arrives. */
+   al_http_header_response_set (request, "Content-Type", "text/plain");
+   al_http_set_body_func (request, example_http_upload_body, NULL);
+   return 0;
+}
+
+AL_HTTP_STREAM_FUNC (example_http_stream_more)
+{
+   /* send another line each time the last one has gone out. */
+   int *count = arg;
+   if (++(*count) > 100)
+      return al_http_stream_end (request);
+   al_http_write_stringf (request, "line %d\n", *count);
+   return 1;
+}
+
+AL_HTTP_FUNC (example_http_stream)
+{
+   /* send our head now and the rest as fast as the client reads it. */
+   int *count = al_arena_calloc (&(request->arena), sizeof (int));
+   al_http_header_response_set (request, "Content-Type", "text/plain");
+   al_http_set_stream_func (request, example_http_stream_more, count);
+   al_http_stream_start (request);
+   return 0;
+}
+
+static void *example_http_defer_thread (void *arg)
+{
+   /* pretend we're waiting on something slow, then answer from here. */
+   struct timespec delay = {0, 100000000};
+   al_http_state_t *request = arg;
+   nanosleep (&delay, NULL);
+   al_http_write_string (request, "Deferred response.\n");
+   al_http_complete (request);
+   return NULL;
+}
+
+AL_HTTP_FUNC (example_http_defer)
+{
+   /* answer from another thread without holding up our reactor. */
+   pthread_t thread;
+   al_http_header_response_set (request, "Content-Type", "text/plain");
+   al_http_defer (request);
+   if (pthread_create (&thread, NULL, example_http_defer_thread, request)
+       != 0) {
+      /* our request is done with once it's completed, so it isn't
+       * pending anymore. */
+      al_http_write_string (request, "Couldn't start a thread.\n");
+      al_http_complete (request);
       return 0;
+   }
+   pthread_detach (thread);
+   return AL_HTTP_PENDING;
+}
+
+AL_HTTP_FUNC (example_http_work)
+{
+   /* something slow enough to run on a worker thread. */
+   unsigned long i, sum = 0;
+   for (i = 0; i < 50000000; i++)
+      sum += i % 7;
+   al_http_header_response_set (request, "Content-Type", "text/plain");
+   al_http_write_stringf (request, "Worked out %lu.\n", sum);
+   return 0;
+}
 
+AL_HTTP_FUNC (example_http_get)
+{
    char html[8192];
 
    /* build a simple HTML page. */
@@ -55,7 +151,7 @@ AL_HTTP_FUNC (example_http_get)
    al_http_write_string (request,
       "<h1>Header:</h1>\n"
       "<table>\n");
-   for (h = request->header_request; h != NULL; h = h->next) {
+   for (h = request->header_request.first; h != NULL; h = h->next) {
       snprintf (html, sizeof (html),
          "  <tr><td><b>%s</b>:</td><td>%s</td></tr>\n", h->name, h->value);
       al_http_write_string (request, html);
@@ -110,12 +206,25 @@ int main (int argc, char **argv)
 
    /* instantiate our server with basic flags. */
    al_server_t *server = al_server_new (port, 0);
+   al_server_set_workers (server, 4, 0);
 
    /* use an HTTP module and assign some basic functions to it. */
    al_http_t *http = al_http_init (server);
    al_http_set_func (http, "GET",   example_http_get);
    al_http_set_func (http, "ERROR", example_http_error);
 
+   /* route some paths to their own functions.  everything else goes to
+    * example_http_get(). */
+   al_http_route_add (http, "GET", "/error",      example_http_error);
+   al_http_route_add (http, "GET", "/no_content", example_http_no_content);
+   al_http_route_add (http, "GET", "/blank",      example_http_blank);
+   al_http_route_add (http, "GET", "/users/:id",  example_http_user);
+   al_http_route_add (http, "POST", "/upload",    example_http_upload);
+   al_http_route_add (http, "GET", "/stream",     example_http_stream);
+   al_http_route_add (http, "GET", "/defer",      example_http_defer);
+   al_http_func_set_worker (
+      al_http_route_add (http, "GET", "/work", example_http_work)->def, 1);
+
    /* start our server. */
    if (!al_server_start (server)) {
       fprintf (stderr, "Server failed to start.\n");